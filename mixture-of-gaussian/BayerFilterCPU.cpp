@@ -0,0 +1,275 @@
+#include "BayerFilterCPU.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define BAYER_USE_SSE2
+#  include <emmintrin.h>
+#endif
+
+namespace
+{
+	// Luma weights (14-bit fixed point), same as in bayer.cl
+	const int coeffR = 4899;
+	const int coeffG = 9617;
+	const int coeffB = 1868;
+	const int lumaShift = 14;
+
+	// Reflects coordinates outside the frame (x = -1 -> 1),
+	// which keeps the Bayer pattern intact
+	inline int mirror(int x, int size)
+	{
+		x = x < 0 ? -x : x;
+		x = x >= size ? 2 * size - 2 - x : x;
+		return std::min(std::max(x, 0), size - 1);
+	}
+
+	inline uchar luma(int r, int g, int b)
+	{
+		const int gray = (r * coeffR + g * coeffG + b * coeffB
+			+ (1 << (lumaShift - 1))) >> lumaShift;
+		return static_cast<uchar>(std::min(gray, 255));
+	}
+}
+
+BayerFilterCPU::BayerFilterCPU()
+	: width(0)
+	, height(0)
+	, invertX(false)
+	, invertY(false)
+	, binned(false)
+{
+}
+
+void BayerFilterCPU::init(int width, int height, EBayerFilter bayerFilter, bool binned)
+{
+	this->width = width;
+	this->height = height;
+	this->binned = binned;
+	// Same as opTrue/opFalse choice of bayer.cl kernels
+	invertX = bayerFilter == Bayer_GR || bayerFilter == Bayer_BG;
+	invertY = bayerFilter == Bayer_GB || bayerFilter == Bayer_BG;
+	dstFrame.create(outputHeight(), outputWidth(), CV_8UC1);
+}
+
+const cv::Mat& BayerFilterCPU::convert(const cv::Mat& src)
+{
+	convertRows(src, dstFrame, 0, outputHeight());
+	return dstFrame;
+}
+
+void BayerFilterCPU::convertRows(const cv::Mat& src, cv::Mat& dst,
+                                 int firstRow, int endRow) const
+{
+	CV_Assert(src.type() == CV_8UC1 && src.rows == height && src.cols == width);
+	CV_Assert(dst.type() == CV_8UC1 && dst.rows == outputHeight() && dst.cols == outputWidth());
+	CV_Assert(firstRow >= 0 && firstRow <= endRow && endRow <= outputHeight());
+
+	if(binned)
+	{
+		for(int y = firstRow; y < endRow; ++y)
+			binRow(src.ptr<uchar>(2 * y), src.ptr<uchar>(2 * y + 1), dst.ptr<uchar>(y));
+		return;
+	}
+
+	for(int y = firstRow; y < endRow; ++y)
+	{
+		const bool yOdd = ((y & 1) != 0) != invertY;
+		convertRow(src.ptr<uchar>(mirror(y - 1, height)),
+			src.ptr<uchar>(y),
+			src.ptr<uchar>(mirror(y + 1, height)),
+			dst.ptr<uchar>(y), yOdd);
+	}
+}
+
+void BayerFilterCPU::convertRow(const uchar* above, const uchar* src,
+                                const uchar* below, uchar* dst, bool yOdd) const
+{
+	// First pixel needs mirrored context
+	dst[0] = convertPixel(above, src, below, 0, yOdd);
+	int x = 1;
+
+#if defined(BAYER_USE_SSE2)
+	// 8 pixels at a time, x is always odd at the start of the block so
+	// every lane has fixed position in the quad. Both interpolations are
+	// computed for all lanes and then selected by lane parity.
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i coeffRG = _mm_setr_epi16(
+		coeffR, coeffG, coeffR, coeffG, coeffR, coeffG, coeffR, coeffG);
+	const __m128i coeffB1 = _mm_setr_epi16(
+		coeffB, 1 << (lumaShift - 1), coeffB, 1 << (lumaShift - 1),
+		coeffB, 1 << (lumaShift - 1), coeffB, 1 << (lumaShift - 1));
+	const __m128i one = _mm_set1_epi16(1);
+	// x / 5 == (x * 13108) >> 16 for x < 16384
+	const __m128i div5 = _mm_set1_epi16(13108);
+
+	// Lanes where the pixel is R or B (G is interpolated from 4 neighbours)
+	const bool firstLaneRB = ((true != invertX) == yOdd);
+	const __m128i evenLanes = _mm_setr_epi16(-1, 0, -1, 0, -1, 0, -1, 0);
+	const __m128i rbMask = firstLaneRB ? evenLanes
+		: _mm_andnot_si128(evenLanes, _mm_set1_epi16(-1));
+
+	for(; x <= width - 9; x += 8)
+	{
+		const __m128i a0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(above + x - 1)), zero);
+		const __m128i a1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(above + x)), zero);
+		const __m128i a2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(above + x + 1)), zero);
+		const __m128i s0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + x - 1)), zero);
+		const __m128i s1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + x)), zero);
+		const __m128i s2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(src + x + 1)), zero);
+		const __m128i l0 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(below + x - 1)), zero);
+		const __m128i l1 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(below + x)), zero);
+		const __m128i l2 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(below + x + 1)), zero);
+
+		const __m128i sumH = _mm_add_epi16(s0, s2);
+		const __m128i sumV = _mm_add_epi16(a1, l1);
+		const __m128i sumD = _mm_add_epi16(_mm_add_epi16(a0, a2), _mm_add_epi16(l0, l2));
+
+		// R or B pixel: G from 4 neighbours, the other color from diagonals
+		const __m128i g1 = _mm_srli_epi16(_mm_add_epi16(sumH, sumV), 2);
+		const __m128i d1 = _mm_srli_epi16(sumD, 2);
+		// G pixel: R and B from 2 neighbours each, G from itself and diagonals
+		const __m128i g2 = _mm_mulhi_epu16(_mm_add_epi16(sumD, s1), div5);
+		const __m128i h2 = _mm_srli_epi16(sumH, 1);
+		const __m128i v2 = _mm_srli_epi16(sumV, 1);
+
+		// In odd rows R lies on R/B lanes and its row neighbours on G lanes
+		const __m128i r1 = yOdd ? s1 : d1;
+		const __m128i r2 = yOdd ? h2 : v2;
+		const __m128i bl1 = yOdd ? d1 : s1;
+		const __m128i bl2 = yOdd ? v2 : h2;
+
+		const __m128i r = _mm_or_si128(_mm_and_si128(rbMask, r1), _mm_andnot_si128(rbMask, r2));
+		const __m128i g = _mm_or_si128(_mm_and_si128(rbMask, g1), _mm_andnot_si128(rbMask, g2));
+		const __m128i b = _mm_or_si128(_mm_and_si128(rbMask, bl1), _mm_andnot_si128(rbMask, bl2));
+
+		// r * coeffR + g * coeffG + b * coeffB + rounding, in 32 bits
+		__m128i lo = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coeffRG),
+			_mm_madd_epi16(_mm_unpacklo_epi16(b, one), coeffB1));
+		__m128i hi = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coeffRG),
+			_mm_madd_epi16(_mm_unpackhi_epi16(b, one), coeffB1));
+		lo = _mm_srai_epi32(lo, lumaShift);
+		hi = _mm_srai_epi32(hi, lumaShift);
+
+		const __m128i gray = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(gray, gray));
+	}
+#endif
+
+	for(; x < width; ++x)
+		dst[x] = convertPixel(above, src, below, x, yOdd);
+}
+
+uchar BayerFilterCPU::convertPixel(const uchar* above, const uchar* src,
+                                   const uchar* below, int x, bool yOdd) const
+{
+	const int xl = mirror(x - 1, width);
+	const int xr = mirror(x + 1, width);
+	const bool xOdd = ((x & 1) != 0) != invertX;
+
+	const int center = src[x];
+	const int sumH = src[xl] + src[xr];
+	const int sumV = above[x] + below[x];
+	const int sumD = above[xl] + above[xr] + below[xl] + below[xr];
+
+	// Same cases as bayer2rgb in bayer.cl
+	if(xOdd == yOdd)
+	{
+		const int g = (sumH + sumV) >> 2;
+		const int d = sumD >> 2;
+		return yOdd ? luma(center, g, d) : luma(d, g, center);
+	}
+	else
+	{
+		const int g = (sumD + center) / 5;
+		return yOdd ? luma(sumH / 2, g, sumV / 2) : luma(sumV / 2, g, sumH / 2);
+	}
+}
+
+void BayerFilterCPU::binRow(const uchar* top, const uchar* bottom, uchar* dst) const
+{
+	// R is where both coordinates are odd (after inversion), B where none is
+	const uchar* rowR = invertY ? top : bottom;
+	const uchar* rowB = invertY ? bottom : top;
+	const int offsetR = invertX ? 0 : 1;
+	const int offsetB = 1 - offsetR;
+
+	const int count = outputWidth();
+	int x = 0;
+
+#if defined(BAYER_USE_SSE2)
+	// 16 source pixels of both rows give 8 quads,
+	// even and odd columns are split into 16-bit lanes
+	const __m128i lowBytes = _mm_set1_epi16(0x00FF);
+	const __m128i coeffRG = _mm_setr_epi16(
+		coeffR, coeffG, coeffR, coeffG, coeffR, coeffG, coeffR, coeffG);
+	const __m128i coeffB1 = _mm_setr_epi16(
+		coeffB, 1 << (lumaShift - 1), coeffB, 1 << (lumaShift - 1),
+		coeffB, 1 << (lumaShift - 1), coeffB, 1 << (lumaShift - 1));
+	const __m128i one = _mm_set1_epi16(1);
+
+	for(; x <= count - 8; x += 8)
+	{
+		const __m128i vr = _mm_loadu_si128((const __m128i*)(rowR + 2 * x));
+		const __m128i vb = _mm_loadu_si128((const __m128i*)(rowB + 2 * x));
+		const __m128i evenR = _mm_and_si128(vr, lowBytes);
+		const __m128i oddR = _mm_srli_epi16(vr, 8);
+		const __m128i evenB = _mm_and_si128(vb, lowBytes);
+		const __m128i oddB = _mm_srli_epi16(vb, 8);
+
+		const __m128i r = offsetR ? oddR : evenR;
+		const __m128i b = offsetB ? oddB : evenB;
+		const __m128i g = _mm_srli_epi16(
+			_mm_add_epi16(offsetR ? evenR : oddR, offsetB ? evenB : oddB), 1);
+
+		__m128i lo = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpacklo_epi16(r, g), coeffRG),
+			_mm_madd_epi16(_mm_unpacklo_epi16(b, one), coeffB1));
+		__m128i hi = _mm_add_epi32(
+			_mm_madd_epi16(_mm_unpackhi_epi16(r, g), coeffRG),
+			_mm_madd_epi16(_mm_unpackhi_epi16(b, one), coeffB1));
+		lo = _mm_srai_epi32(lo, lumaShift);
+		hi = _mm_srai_epi32(hi, lumaShift);
+
+		const __m128i gray = _mm_packs_epi32(lo, hi);
+		_mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(gray, gray));
+	}
+#endif
+
+	for(; x < count; ++x)
+	{
+		const int r = rowR[2 * x + offsetR];
+		const int b = rowB[2 * x + offsetB];
+		const int g = (rowR[2 * x + offsetB] + rowB[2 * x + offsetR]) >> 1;
+		dst[x] = luma(r, g, b);
+	}
+}
+
+void BayerFilterCPU::upscaleMask(const cv::Mat& mask, cv::Mat& dst) const
+{
+	CV_Assert(mask.type() == CV_8UC1 && mask.rows == outputHeight() && mask.cols == outputWidth());
+	dst.create(height, width, CV_8UC1);
+
+	// Odd last row/column of sensor frame repeats the last one of mask
+	const int maskWidth = mask.cols;
+	for(int y = 0; y < height; ++y)
+	{
+		const uchar* src = mask.ptr<uchar>(std::min(y / 2, mask.rows - 1));
+		uchar* dstRow = dst.ptr<uchar>(y);
+		int x = 0;
+
+#if defined(BAYER_USE_SSE2)
+		for(; x <= maskWidth - 16; x += 16)
+		{
+			const __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+			_mm_storeu_si128((__m128i*)(dstRow + 2 * x), _mm_unpacklo_epi8(v, v));
+			_mm_storeu_si128((__m128i*)(dstRow + 2 * x + 16), _mm_unpackhi_epi8(v, v));
+		}
+#endif
+
+		for(x *= 2; x < width; ++x)
+			dstRow[x] = src[std::min(x / 2, maskWidth - 1)];
+	}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+
+#include "BayerPattern.h"
+
+//
+// Converts Bayer mosaic straight to gray in one pass, without intermediate
+// RGB frame. Interpolation and luma weights are the same as in bayer.cl,
+// so host and device rows of a frame match exactly. Binned mode turns every
+// 2x2 quad into one gray pixel instead (half size output, as binned bayer.cl
+// kernels do).
+//
+
+class BayerFilterCPU
+{
+public:
+	BayerFilterCPU();
+
+	// width/height - size of the sensor frame
+	void init(int width, int height, EBayerFilter bayerFilter, bool binned = false);
+
+	// Returned frame is owned by converter and overwritten on next call
+	const cv::Mat& convert(const cv::Mat& src);
+
+	// Converts only rows [firstRow, endRow) of output into dst (CV_8U, 
+	// output size), can be called concurrently for disjoint ranges of rows
+	void convertRows(const cv::Mat& src, cv::Mat& dst,
+		int firstRow, int endRow) const;
+
+	// Scales mask of binned frame (output size) back to sensor size
+	void upscaleMask(const cv::Mat& mask, cv::Mat& dst) const;
+
+	int outputWidth() const { return binned ? width / 2 : width; }
+	int outputHeight() const { return binned ? height / 2 : height; }
+	bool isBinned() const { return binned; }
+
+private:
+	void convertRow(const uchar* above, const uchar* src, const uchar* below,
+		uchar* dst, bool yOdd) const;
+	uchar convertPixel(const uchar* above, const uchar* src, const uchar* below,
+		int x, bool yOdd) const;
+	void binRow(const uchar* top, const uchar* bottom, uchar* dst) const;
+
+private:
+	int width;
+	int height;
+	// Pattern relative to Bayer_RG
+	bool invertX;
+	bool invertY;
+	bool binned;
+	cv::Mat dstFrame;
+};
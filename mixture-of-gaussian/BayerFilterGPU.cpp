@@ -1,13 +1,33 @@
 #include "BayerFilterGPU.h"
+#include "WorkGroupTuner.h"
 
+#include <algorithm>
 #include <iostream>
 
+namespace
+{
+	// Border kernel is 1D and tiny, its size doesn't need tuning
+	const int borderWorkGroupSize = 64;
+
+	// Source tile of tiled kernels (quads of work-items plus 1 pixel apron)
+	size_t tileBytes(int workGroupSizeX, int workGroupSizeY)
+	{
+		return size_t(2 * workGroupSizeX + 2) * (2 * workGroupSizeY + 2);
+	}
+}
+
 BayerFilterGPU::BayerFilterGPU(const clw::Context& context,
                                const clw::Device& device, 
                                const clw::CommandQueue& queue)
 	: context(context)
 	, device(device)
 	, queue(queue)
+	, width(0)
+	, height(0)
+	, kernelType(BayerKernel_Simple)
+	, localMemSize(0)
+	, workGroupSizeX(0)
+	, workGroupSizeY(0)
 {
 }
 
@@ -15,20 +35,61 @@ void BayerFilterGPU::init(int imageWidth,
                           int imageHeight,
                           int workGroupSizeX,
                           int workGroupSizeY,
-						  EBayerFilter filter)
+						  EBayerFilter filter,
+						  EBayerKernel kernelType)
 {
-	createBayer2GrayKernel(filter);
-	createOutputImage(imageWidth, imageHeight);
-
 	width = imageWidth;
 	height = imageHeight;
+
+	cl_ulong localMem = 0;
+	clGetDeviceInfo(device.deviceId(), CL_DEVICE_LOCAL_MEM_SIZE,
+		sizeof(localMem), &localMem, nullptr);
+	localMemSize = size_t(localMem);
+
+	this->kernelType = kernelType;
+	if(!tileFits(workGroupSizeX, workGroupSizeY))
+	{
+		std::cout << "  local memory too small for tiled Bayer kernel ("
+			<< workGroupSizeX << "x" << workGroupSizeY << "), using simple one\n";
+		this->kernelType = BayerKernel_Simple;
+	}
+	createBayer2GrayKernel(filter, this->kernelType);
+	createOutputImage(outputWidth(), outputHeight());
+
 	cl_int2 frameSize = {{ width, height }};
 
 	// Ustawienie argumentow i parametrow kerneli
-	kernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
-	kernel.setRoundedGlobalWorkSize(width, height);
 	kernel.setArg(1, outputImage);
 	kernel.setArg(2, frameSize);
+	setKernelWorkGroupSize(workGroupSizeX, workGroupSizeY);
+
+	if(!borderKernel.isNull())
+	{
+		const int borderSize = 2 * width + 2 * std::max(height - 2, 0);
+		borderKernel.setLocalWorkSize(borderWorkGroupSize, 1);
+		borderKernel.setRoundedGlobalWorkSize(borderSize, 1);
+		borderKernel.setArg(1, outputImage);
+		borderKernel.setArg(2, frameSize);
+	}
+}
+
+void BayerFilterGPU::initMaskUpscale(int workGroupSizeX,
+                                     int workGroupSizeY)
+{
+	if(upscaleKernel.isNull())
+		return;
+
+	// Mask in sensor resolution
+	upscaledImage = context.createImage2D
+		(clw::Access_WriteOnly, clw::Location_Device,
+		 clw::ImageFormat(clw::Order_R, clw::Type_Normalized_UInt8),
+		 width, height);
+
+	cl_int2 frameSize = {{ width, height }};
+	upscaleKernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
+	upscaleKernel.setRoundedGlobalWorkSize(width, height);
+	upscaleKernel.setArg(1, upscaledImage);
+	upscaleKernel.setArg(2, frameSize);
 }
 
 void BayerFilterGPU::setKernelWorkGroupSize(int workGroupSizeX,
@@ -36,20 +97,100 @@ void BayerFilterGPU::setKernelWorkGroupSize(int workGroupSizeX,
 {
 	if(!kernel.isNull())
 	{
+		this->workGroupSizeX = workGroupSizeX;
+		this->workGroupSizeY = workGroupSizeY;
 		kernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
-		kernel.setRoundedGlobalWorkSize(width, height);
+		setGlobalWorkSize();
+		// Tile is sized for this local size (process() won't run sizes
+		// that don't fit, tuner then skips them)
+		if(kernelType == BayerKernel_Tiled && tileFits(workGroupSizeX, workGroupSizeY))
+			clSetKernelArg(kernel.kernelId(), 3, tileBytes(workGroupSizeX, workGroupSizeY), nullptr);
+	}
+}
+
+bool BayerFilterGPU::tileFits(int workGroupSizeX, int workGroupSizeY) const
+{
+	return kernelType != BayerKernel_Tiled ||
+		tileBytes(workGroupSizeX, workGroupSizeY) <= localMemSize;
+}
+
+void BayerFilterGPU::setGlobalWorkSize()
+{
+	int globalWidth, globalHeight;
+	globalWorkSize(&globalWidth, &globalHeight);
+	kernel.setRoundedGlobalWorkSize(globalWidth, globalHeight);
+}
+
+void BayerFilterGPU::globalWorkSize(int* globalWidth, int* globalHeight) const
+{
+	// Tiled kernels convert 2x2 quads, binned ones bin them to one pixel
+	// while plain ones skip the border (it's done by border kernel)
+	switch(kernelType)
+	{
+	case BayerKernel_Tiled:
+		*globalWidth = (width + 1) / 2;
+		*globalHeight = (height + 1) / 2;
+		break;
+	case BayerKernel_Binned:
+		*globalWidth = std::max(width / 2, 1);
+		*globalHeight = std::max(height / 2, 1);
+		break;
+	case BayerKernel_Simple:
+	default:
+		*globalWidth = std::max(width - 2, 1);
+		*globalHeight = std::max(height - 2, 1);
+		break;
+	}
+}
+
+void BayerFilterGPU::tuneWorkGroupSize(WorkGroupTuner& tuner,
+                                       clw::Buffer& sampleInput,
+                                       int* workGroupSizeX,
+                                       int* workGroupSizeY)
+{
+	const int defaultX = *workGroupSizeX;
+	const int defaultY = *workGroupSizeY;
+	int globalWidth, globalHeight;
+	globalWorkSize(&globalWidth, &globalHeight);
+	tuner.tune(device, kernel, kernelName, globalWidth, globalHeight, queue,
+		[this](int x, int y) { setKernelWorkGroupSize(x, y); },
+		[&] { return process(sampleInput); },
+		workGroupSizeX, workGroupSizeY);
+
+	// Cached size might have been tuned with more local memory
+	if(!tileFits(*workGroupSizeX, *workGroupSizeY))
+	{
+		*workGroupSizeX = defaultX;
+		*workGroupSizeY = defaultY;
+		setKernelWorkGroupSize(defaultX, defaultY);
 	}
 }
 
 clw::Event BayerFilterGPU::process(clw::Buffer& inputImage)
 {
-	if(kernel.isNull())
+	if(kernel.isNull() || !tileFits(workGroupSizeX, workGroupSizeY))
 		return clw::Event();
 	kernel.setArg(0, inputImage);
-	return queue.asyncRunKernel(kernel);
+	clw::Event event = queue.asyncRunKernel(kernel);
+
+	lastBorderEvent = clw::Event();
+	if(!borderKernel.isNull())
+	{
+		borderKernel.setArg(0, inputImage);
+		lastBorderEvent = queue.asyncRunKernel(borderKernel);
+	}
+	return event;
 }
 
-void BayerFilterGPU::createBayer2GrayKernel(EBayerFilter bayerFilter)
+clw::Event BayerFilterGPU::upscaleMask(const clw::Image2D& mask)
+{
+	if(upscaleKernel.isNull() || upscaledImage.isNull())
+		return clw::Event();
+	upscaleKernel.setArg(0, mask);
+	return queue.asyncRunKernel(upscaleKernel);
+}
+
+void BayerFilterGPU::createBayer2GrayKernel(EBayerFilter bayerFilter, EBayerKernel kernelType)
 {
 	clw::Program progCvt = context.createProgramFromSourceFile("bayer.cl");
 	if(!progCvt.build())
@@ -61,19 +202,22 @@ void BayerFilterGPU::createBayer2GrayKernel(EBayerFilter bayerFilter)
 
 	switch(bayerFilter)
 	{
-	case Bayer_RG:
-		kernel = progCvt.createKernel("convert_rg2gray");
-		break;
-	case Bayer_BG:
-		kernel = progCvt.createKernel("convert_bg2gray");
-		break;
-	case Bayer_GR:
-		kernel = progCvt.createKernel("convert_gr2gray");
-		break;
-	case Bayer_GB:
-		kernel = progCvt.createKernel("convert_gb2gray");
-		break;
+	case Bayer_RG: kernelName = "convert_rg2gray"; break;
+	case Bayer_BG: kernelName = "convert_bg2gray"; break;
+	case Bayer_GR: kernelName = "convert_gr2gray"; break;
+	case Bayer_GB: kernelName = "convert_gb2gray"; break;
 	}
+	if(kernelType == BayerKernel_Tiled)
+		kernelName += "_tiled";
+	else if(kernelType == BayerKernel_Binned)
+		kernelName += "_binned";
+	kernel = progCvt.createKernel(kernelName);
+
+	// Tiled and binned kernels handle frame edges themselves
+	borderKernel = kernelType == BayerKernel_Simple 
+		? progCvt.createKernel(kernelName + "_border") : clw::Kernel();
+	upscaleKernel = kernelType == BayerKernel_Binned
+		? progCvt.createKernel("upscale_binned_mask") : clw::Kernel();
 }
 
 void BayerFilterGPU::createOutputImage(int width,
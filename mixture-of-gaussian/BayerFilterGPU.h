@@ -1,13 +1,17 @@
 #pragma once
 
 #include <clw/clw.h>
+#include <string>
 
-enum EBayerFilter
+#include "BayerPattern.h"
+
+class WorkGroupTuner;
+
+enum EBayerKernel
 {
-	Bayer_RG,
-	Bayer_BG,
-	Bayer_GR,
-	Bayer_GB
+	BayerKernel_Simple, // pixel per work-item, 9 reads from global memory
+	BayerKernel_Tiled,  // 2x2 quad per work-item, source staged in local memory
+	BayerKernel_Binned  // 2x2 quad binned to one gray pixel, half size output
 };
 
 class BayerFilterGPU
@@ -17,17 +21,41 @@ public:
 		const clw::Device& device,
 		const clw::CommandQueue& queue);
 
+	// imageWidth/Height - size of the sensor frame,
+	// output is half of it for binned kernel (odd last row/column is dropped)
 	void init(int imageWidth, int imageHeight,
 		int workGroupSizeX, int workGroupSizeY,
-		EBayerFilter bayerFilter);
+		EBayerFilter bayerFilter, EBayerKernel kernelType = BayerKernel_Tiled);
+	// Prepares upscaleMask() (binned kernel only)
+	void initMaskUpscale(int workGroupSizeX, int workGroupSizeY);
 
 	void setKernelWorkGroupSize(int workGroupSizeX, int workGroupSizeY);
 
+	// Finds best local size running the kernel on sampleInput (on first
+	// use per device and frame size).
+	// workGroupSizeX/Y - in: default size, out: size being used
+	void tuneWorkGroupSize(WorkGroupTuner& tuner, clw::Buffer& sampleInput,
+		int* workGroupSizeX, int* workGroupSizeY);
+
+	// Returns event of the main kernel, simple variant
+	// enqueues border kernel after it
 	clw::Event process(clw::Buffer& inputImage);
+	// Border kernel enqueued by last process() (null for other variants)
+	clw::Event borderEvent() const { return lastBorderEvent; }
 	clw::Image2D output() const { return outputImage; }
+	int outputWidth() const { return kernelType == BayerKernel_Binned ? width / 2 : width; }
+	int outputHeight() const { return kernelType == BayerKernel_Binned ? height / 2 : height; }
+
+	// Scales mask computed on binned frame back to sensor resolution
+	clw::Event upscaleMask(const clw::Image2D& mask);
+	clw::Image2D upscaledMask() const { return upscaledImage; }
 
 private:
-	void createBayer2GrayKernel(EBayerFilter bayerFilter);
+	void createBayer2GrayKernel(EBayerFilter bayerFilter, EBayerKernel kernelType);
+	void setGlobalWorkSize();
+	void globalWorkSize(int* globalWidth, int* globalHeight) const;
+	// Local memory holds tile of tiled kernel for given local size
+	bool tileFits(int workGroupSizeX, int workGroupSizeY) const;
 	void createOutputImage(int width, int height);
 
 private:
@@ -35,9 +63,18 @@ private:
 	clw::Device device;
 	clw::CommandQueue queue;
 	clw::Kernel kernel;
+	clw::Kernel borderKernel;
+	clw::Kernel upscaleKernel;
+	clw::Event lastBorderEvent;
 	clw::Image2D outputImage;
+	clw::Image2D upscaledImage;
+	std::string kernelName;
 	int width;
 	int height;
+	EBayerKernel kernelType;
+	size_t localMemSize; // CL_DEVICE_LOCAL_MEM_SIZE
+	int workGroupSizeX;
+	int workGroupSizeY;
 
 private:
 	BayerFilterGPU(const BayerFilterGPU&);
@@ -0,0 +1,11 @@
+#pragma once
+
+// Sensor mosaic layout, named as OpenCV does (after colors of
+// the 2nd and 3rd pixel in the 2nd row, so Bayer_RG starts with B G)
+enum EBayerFilter
+{
+	Bayer_RG,
+	Bayer_BG,
+	Bayer_GR,
+	Bayer_GB
+};
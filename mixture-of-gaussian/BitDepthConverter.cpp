@@ -0,0 +1,152 @@
+#include "BitDepthConverter.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define BITDEPTH_USE_SSE2
+#  include <emmintrin.h>
+#endif
+
+BitDepthConverter::BitDepthConverter()
+	: depth(8)
+	, windowMode(BitDepth_TopBits)
+	, gainMin(0)
+	, gainMax(0)
+{
+}
+
+void BitDepthConverter::init(int width, int height, int pixelDepth,
+                             EBitDepthWindow window, float gamma)
+{
+	depth = std::min(std::max(pixelDepth, 8), 16);
+	windowMode = window;
+	dstFrame.create(height, width, CV_8UC1);
+
+	lut.clear();
+	if(windowMode == BitDepth_Lut)
+	{
+		buildGammaTable(gamma);
+	}
+	else if(windowMode == BitDepth_AutoGain)
+	{
+		// Start with full range, adapt after first frame
+		gainMin = 0;
+		gainMax = static_cast<ushort>((1 << depth) - 1);
+		buildGainTable(gainMin, gainMax);
+	}
+}
+
+void BitDepthConverter::setLookupTable(const std::vector<uchar>& table)
+{
+	if(table.size() == size_t(1 << depth))
+	{
+		lut = table;
+		windowMode = BitDepth_Lut;
+	}
+}
+
+const cv::Mat& BitDepthConverter::convert(const cv::Mat& src)
+{
+	CV_Assert(src.type() == CV_16UC1 && src.size() == dstFrame.size());
+
+	int rows = src.rows;
+	int cols = src.cols;
+	if(src.isContinuous() && dstFrame.isContinuous())
+	{
+		cols *= rows;
+		rows = 1;
+	}
+
+	ushort frameMin = 0xFFFF;
+	ushort frameMax = 0;
+
+	for(int y = 0; y < rows; ++y)
+	{
+		const ushort* srcRow = src.ptr<ushort>(y);
+		uchar* dstRow = dstFrame.ptr<uchar>(y);
+
+		if(windowMode == BitDepth_TopBits)
+			convertShift(srcRow, dstRow, cols, depth - 8);
+		else
+			convertLut(srcRow, dstRow, cols, &frameMin, &frameMax);
+	}
+
+	// Gain for the next frame is based on range of the current one
+	if(windowMode == BitDepth_AutoGain && frameMax > frameMin &&
+		(frameMin != gainMin || frameMax != gainMax))
+	{
+		buildGainTable(frameMin, frameMax);
+	}
+
+	return dstFrame;
+}
+
+void BitDepthConverter::convertShift(const ushort* src, uchar* dst,
+                                     int count, int shift)
+{
+	int x = 0;
+
+#if defined(BITDEPTH_USE_SSE2)
+	const __m128i vshift = _mm_cvtsi32_si128(shift);
+
+	for(; x <= count - 16; x += 16)
+	{
+		__m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+		__m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x + 8));
+		v0 = _mm_srl_epi16(v0, vshift);
+		v1 = _mm_srl_epi16(v1, vshift);
+		// Saturating pack handles garbage in unused high bits
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_packus_epi16(v0, v1));
+	}
+#endif
+
+	for(; x < count; ++x)
+	{
+		int v = src[x] >> shift;
+		dst[x] = static_cast<uchar>(v > 255 ? 255 : v);
+	}
+}
+
+void BitDepthConverter::convertLut(const ushort* src, uchar* dst, int count,
+                                   ushort* minValue, ushort* maxValue)
+{
+	const ushort mask = static_cast<ushort>((1 << depth) - 1);
+	const uchar* table = lut.data();
+	ushort vmin = *minValue;
+	ushort vmax = *maxValue;
+
+	for(int x = 0; x < count; ++x)
+	{
+		ushort v = src[x] & mask;
+		dst[x] = table[v];
+		vmin = v < vmin ? v : vmin;
+		vmax = v > vmax ? v : vmax;
+	}
+
+	*minValue = vmin;
+	*maxValue = vmax;
+}
+
+void BitDepthConverter::buildGammaTable(float gamma)
+{
+	const int size = 1 << depth;
+	const float invMax = 1.0f / float(size - 1);
+	const float invGamma = gamma > 0 ? 1.0f / gamma : 1.0f;
+
+	lut.resize(size);
+	for(int i = 0; i < size; ++i)
+		lut[i] = cv::saturate_cast<uchar>(255.0f * std::pow(i * invMax, invGamma));
+}
+
+void BitDepthConverter::buildGainTable(ushort minValue, ushort maxValue)
+{
+	const int size = 1 << depth;
+	const float scale = 255.0f / float(std::max(1, maxValue - minValue));
+
+	lut.resize(size);
+	for(int i = 0; i < size; ++i)
+		lut[i] = cv::saturate_cast<uchar>((i - minValue) * scale);
+
+	gainMin = minValue;
+	gainMax = maxValue;
+}
\ No newline at end of file
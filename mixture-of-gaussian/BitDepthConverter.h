@@ -0,0 +1,50 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+enum EBitDepthWindow
+{
+	BitDepth_TopBits,  // drop (depth - 8) least significant bits
+	BitDepth_AutoGain, // stretch [min, max] of previous frame to [0, 255]
+	BitDepth_Lut,      // arbitrary lookup table (gamma curve by default)
+	BitDepth_Native    // no conversion, frames are passed as 16 bits
+};
+
+//
+// Converts 10/12/16-bit single channel frames to 8 bits in one pass
+// into a preallocated frame (no per-frame allocation)
+//
+
+class BitDepthConverter
+{
+public:
+	BitDepthConverter();
+
+	void init(int width, int height, int pixelDepth,
+		EBitDepthWindow window, float gamma = 1.0f);
+
+	// Sets custom lookup table (must have 1 << pixelDepth entries)
+	void setLookupTable(const std::vector<uchar>& table);
+
+	// Returned frame is owned by converter and overwritten on next call
+	const cv::Mat& convert(const cv::Mat& src);
+
+	int pixelDepth() const { return depth; }
+	EBitDepthWindow window() const { return windowMode; }
+
+private:
+	void convertShift(const ushort* src, uchar* dst, int count, int shift);
+	void convertLut(const ushort* src, uchar* dst, int count,
+		ushort* minValue, ushort* maxValue);
+	void buildGammaTable(float gamma);
+	void buildGainTable(ushort minValue, ushort maxValue);
+
+private:
+	int depth;
+	EBitDepthWindow windowMode;
+	ushort gainMin;
+	ushort gainMax;
+	std::vector<uchar> lut;
+	cv::Mat dstFrame;
+};
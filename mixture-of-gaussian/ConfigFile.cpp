@@ -177,4 +177,39 @@ bool ConfigFile::exists(const string& key, const string& section)
 			return true;
 		}
 	}
+}
+
+std::vector<string> ConfigFile::keys(const string& section)
+{
+	std::vector<string> result;
+	auto seci = mSettings.find(section);
+	if(seci != mSettings.end())
+	{
+		for(auto i = seci->second->begin(); i != seci->second->end(); ++i)
+			result.push_back(i->first);
+	}
+	return result;
+}
+
+void ConfigFile::swap(ConfigFile& other)
+{
+	mSettings.swap(other.mSettings);
+}
+
+StreamConfig::StreamConfig(ConfigFile& cfg, const string& streamSection)
+	: cfg(&cfg)
+	, section(streamSection)
+{
+}
+
+string StreamConfig::value(const string& key, const string& section) const
+{
+	if(cfg->exists(key, this->section))
+		return cfg->value(key, this->section);
+	return cfg->value(key, section);
+}
+
+bool StreamConfig::exists(const string& key, const string& section) const
+{
+	return cfg->exists(key, this->section) || cfg->exists(key, section);
 }
\ No newline at end of file
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <unordered_map>
 
 class ConfigFile
@@ -20,6 +21,10 @@ public:
 	std::string value(const std::string& key, const std::string& section);
 	// Sprawdza czy podany klucz w danej sekcji istnieje
 	bool exists(const std::string& key, const std::string& section);
+	// Zwraca wszystkie klucze z danej sekcji
+	std::vector<std::string> keys(const std::string& section);
+	// Wymienia zawartosc z innym obiektem (np. po ponownym wczytaniu pliku)
+	void swap(ConfigFile& other);
 
 private:
 	// Mapa sekcja - mapa[kluczy - wartosci]
@@ -32,3 +37,22 @@ private:
 	ConfigFile(const ConfigFile& other);
 	ConfigFile& operator=(const ConfigFile& other);
 };
+
+//
+// Stream specific view on configuration - keys found in stream's own 
+// section (e.g. [VideoStream7]) override the ones from global sections
+//
+
+class StreamConfig
+{
+public:
+	StreamConfig(ConfigFile& cfg, const std::string& streamSection);
+
+	std::string value(const std::string& key, const std::string& section) const;
+	bool exists(const std::string& key, const std::string& section) const;
+	const std::string& streamSection() const { return section; }
+
+private:
+	ConfigFile* cfg;
+	std::string section;
+};
@@ -0,0 +1,203 @@
+#include "DeviceScheduler.h"
+
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	// Moving a stream costs a model transfer and recompilation,
+	// only do it for a clear gain
+	const double minRebalanceGain = 0.8;
+	// Weight of the newest measurement
+	const double costSmoothing = 0.1;
+}
+
+DeviceScheduler::DeviceScheduler()
+{
+}
+
+bool DeviceScheduler::addDevice(const clw::Device& device)
+{
+	clw::Context context;
+	if(!context.create(std::vector<clw::Device>(1, device)))
+	{
+		std::cerr << "Couldn't create context for " << device.name() << "\n";
+		return false;
+	}
+	return addDevice(context, device);
+}
+
+bool DeviceScheduler::addDevice(const clw::Context& context, const clw::Device& device)
+{
+	Slot slot;
+	slot.context = context;
+	slot.device = device;
+	slot.capacity = std::max(1.0, 
+		double(device.maxComputeUnits()) * device.maxClockFrequency());
+	slots.push_back(slot);
+
+	std::cout << "Using " << device.name() << ", " << device.vendor() << "\n";
+	return true;
+}
+
+size_t DeviceScheduler::assign(const std::string& stream)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	// Unknown cost of a new stream, assume average one (on first device)
+	double averageCost = 1.0;
+	if(!streams.empty())
+	{
+		double sum = 0;
+		for(auto& entry : streams)
+			sum += estimatedCost(entry.second, 0);
+		averageCost = std::max(sum / streams.size(), 1e-3);
+	}
+
+	std::vector<double> load = loads();
+	size_t best = 0;
+	double bestScore = 0;
+
+	for(size_t i = 0; i < slots.size(); ++i)
+	{
+		// Cost scales inversely with capacity when not measured
+		double score = load[i] + averageCost * slots[0].capacity / slots[i].capacity;
+		if(i == 0 || score < bestScore)
+		{
+			best = i;
+			bestScore = score;
+		}
+	}
+
+	StreamInfo& info = streams[stream];
+	info.device = best;
+	info.cost.clear();
+	info.guess = averageCost;
+	return best;
+}
+
+size_t DeviceScheduler::deviceOf(const std::string& stream) const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = streams.find(stream);
+	return it != streams.end() ? it->second.device : 0;
+}
+
+void DeviceScheduler::retainStreams(const std::vector<std::string>& running)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	for(auto it = streams.begin(); it != streams.end(); )
+	{
+		if(std::find(running.begin(), running.end(), it->first) == running.end())
+			it = streams.erase(it);
+		else
+			++it;
+	}
+}
+
+void DeviceScheduler::reportCost(const std::string& stream, double cost)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = streams.find(stream);
+	if(it == streams.end())
+		return;
+
+	StreamInfo& info = it->second;
+	auto found = info.cost.find(info.device);
+	if(found == info.cost.end())
+		info.cost[info.device] = cost;
+	else
+		found->second += costSmoothing * (cost - found->second);
+}
+
+bool DeviceScheduler::rebalance(double frameBudget, std::string* stream, size_t* target)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if(slots.size() < 2)
+		return false;
+
+	std::vector<double> load = loads();
+	size_t busiest = std::max_element(load.begin(), load.end()) - load.begin();
+	const double maxLoad = load[busiest];
+
+	if(maxLoad <= frameBudget)
+		return false;
+
+	// Pick the move giving the lowest resulting maximum load
+	double bestMax = maxLoad * minRebalanceGain;
+	bool found = false;
+
+	for(auto& entry : streams)
+	{
+		const StreamInfo& info = entry.second;
+		if(info.device != busiest)
+			continue;
+
+		const double costHere = estimatedCost(info, busiest);
+		for(size_t i = 0; i < slots.size(); ++i)
+		{
+			if(i == busiest)
+				continue;
+
+			double newMax = 0;
+			for(size_t j = 0; j < slots.size(); ++j)
+			{
+				double l = load[j];
+				if(j == busiest)
+					l -= costHere;
+				else if(j == i)
+					l += estimatedCost(info, i);
+				newMax = std::max(newMax, l);
+			}
+
+			if(newMax < bestMax)
+			{
+				bestMax = newMax;
+				*stream = entry.first;
+				*target = i;
+				found = true;
+			}
+		}
+	}
+
+	return found;
+}
+
+void DeviceScheduler::moved(const std::string& stream, size_t target)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = streams.find(stream);
+	if(it == streams.end())
+		return;
+
+	it->second.device = target;
+}
+
+std::vector<double> DeviceScheduler::deviceLoads() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return loads();
+}
+
+double DeviceScheduler::estimatedCost(const StreamInfo& info, size_t device) const
+{
+	auto found = info.cost.find(device);
+	if(found != info.cost.end())
+		return found->second;
+
+	// Not run there yet, scale cost measured elsewhere by capacity
+	if(!info.cost.empty())
+	{
+		auto measured = info.cost.begin();
+		return measured->second * slots[measured->first].capacity / slots[device].capacity;
+	}
+	return info.guess * slots[0].capacity / slots[device].capacity;
+}
+
+std::vector<double> DeviceScheduler::loads() const
+{
+	std::vector<double> load(slots.size(), 0.0);
+	for(auto& entry : streams)
+		load[entry.second.device] += estimatedCost(entry.second, entry.second.device);
+	return load;
+}
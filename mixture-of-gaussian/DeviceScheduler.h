@@ -0,0 +1,77 @@
+#pragma once
+
+#include <clw/clw.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//
+// Spreads streams over all OpenCL devices. Every device gets its own
+// context (workers create their own queues). New streams go to the device
+// with the lowest load relative to its estimated capacity; once per-stream
+// costs are measured (device time per frame), streams are moved off
+// saturated devices.
+//
+
+class DeviceScheduler
+{
+public:
+	struct Slot
+	{
+		clw::Context context;
+		clw::Device device;
+		double capacity; // compute units * clock, only as a first guess
+	};
+
+	DeviceScheduler();
+
+	// Adds device with its own context
+	bool addDevice(const clw::Device& device);
+	bool addDevice(const clw::Context& context, const clw::Device& device);
+
+	size_t numDevices() const { return slots.size(); }
+	Slot& slot(size_t index) { return slots[index]; }
+
+	// Picks device for a new stream (thread-safe)
+	size_t assign(const std::string& stream);
+	size_t deviceOf(const std::string& stream) const;
+
+	// Forget streams that are no longer running
+	void retainStreams(const std::vector<std::string>& running);
+
+	// Device time of the last frame of the stream [ms]
+	void reportCost(const std::string& stream, double cost);
+
+	// Finds a stream worth moving: the most loaded device is saturated
+	// (its load exceeds frameBudget, 0 - always) and moving lowers
+	// the maximum load noticeably. Call moved() once it's done.
+	bool rebalance(double frameBudget, std::string* stream, size_t* target);
+	void moved(const std::string& stream, size_t target);
+
+	// Sum of measured stream costs per device [ms per frame]
+	std::vector<double> deviceLoads() const;
+
+private:
+	struct StreamInfo
+	{
+		size_t device;
+		// Smoothed cost on every device the stream has run on
+		std::map<size_t, double> cost;
+		// Cost on the first device until something is measured
+		double guess;
+	};
+
+	double estimatedCost(const StreamInfo& info, size_t device) const;
+	std::vector<double> loads() const;
+
+private:
+	std::vector<Slot> slots;
+	std::map<std::string, StreamInfo> streams;
+	mutable std::mutex mutex;
+
+private:
+	DeviceScheduler(const DeviceScheduler&);
+	DeviceScheduler& operator=(const DeviceScheduler&);
+};
@@ -0,0 +1,177 @@
+#include "FrameGovernor.h"
+#include "ConfigFile.h"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+namespace
+{
+	// Maximum decimation in Drop_Decimate mode
+	const int maxStride = 8;
+	// Processed frames with plenty of slack before stride is lowered
+	const int slackFramesToRecover = 30;
+
+	double percentileMs(const LatencyHistogram& hist, double p)
+	{
+		return hist.percentile(p) * 1e-6;
+	}
+}
+
+FrameGovernor::FrameGovernor(int frameInterval, double latencyBudget, EDropPolicy policy)
+	: frameInterval(std::max(frameInterval, 0))
+	, latencyBudget(std::max(latencyBudget, 0.0))
+	, policy(latencyBudget > 0 ? policy : Drop_None)
+	, nextDue(clock::now())
+	, captureTime(nextDue)
+	, admitTime(nextDue)
+	, estimatedCost(0)
+	, stride(1)
+	, frameIndex(0)
+	, slackFrames(0)
+	, statsStart(nextDue)
+	, processed(0)
+	, dropped(0)
+	, deadlineMisses(0)
+{
+}
+
+bool FrameGovernor::admit()
+{
+	const clock::time_point now = clock::now();
+
+	// Start the clock with first frame, not at construction (opening
+	// the stream may take a while)
+	if(frameIndex == 0)
+		nextDue = now;
+
+	if(frameInterval.count() > 0)
+	{
+		// Frame is considered captured at the latest nominal slot not after
+		// the grab. When we're whole frames behind (source slower than
+		// FrameInterval, a stall) those frames are gone, so the clock jumps
+		// ahead instead of accumulating lateness that never recovers.
+		if(now - nextDue >= frameInterval)
+			nextDue += (now - nextDue) / frameInterval * frameInterval;
+		captureTime = nextDue;
+		nextDue += frameInterval;
+	}
+	else
+	{
+		captureTime = now;
+		nextDue = now;
+	}
+
+	bool process = true;
+	const double lateness = elapsedMs(captureTime, now);
+
+	if(policy == Drop_Stale)
+	{
+		// Dropping only helps if the budget is achievable at all
+		process = estimatedCost >= latencyBudget ||
+			lateness + estimatedCost <= latencyBudget;
+	}
+	else if(policy == Drop_Decimate)
+	{
+		process = (frameIndex % stride) == 0;
+	}
+	++frameIndex;
+
+	if(!process)
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		++dropped;
+		return false;
+	}
+
+	admitTime = now;
+	return true;
+}
+
+void FrameGovernor::completed()
+{
+	const clock::time_point now = clock::now();
+	const double latency = elapsedMs(captureTime, now);
+	const double cost = elapsedMs(admitTime, now);
+
+	estimatedCost = estimatedCost > 0 ? 0.9 * estimatedCost + 0.1 * cost : cost;
+
+	const bool missed = latencyBudget > 0 && latency > latencyBudget;
+
+	if(policy == Drop_Decimate)
+	{
+		if(missed)
+		{
+			stride = std::min(stride + 1, maxStride);
+			slackFrames = 0;
+		}
+		else if(latency < 0.75 * latencyBudget && stride > 1 &&
+			++slackFrames >= slackFramesToRecover)
+		{
+			--stride;
+			slackFrames = 0;
+		}
+	}
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+	++processed;
+	if(missed)
+		++deadlineMisses;
+	latencies.record(elapsedNs(captureTime, now));
+	processingTimes.record(elapsedNs(admitTime, now));
+}
+
+FrameGovernor::Stats FrameGovernor::collectStats()
+{
+	LatencyHistogram latency;
+	LatencyHistogram processing;
+	Stats stats;
+	const clock::time_point now = clock::now();
+
+	{
+		std::lock_guard<std::mutex> lock(statsMutex);
+		double seconds = elapsedMs(statsStart, now) * 1e-3;
+		stats.fps = seconds > 0 ? processed / seconds : 0;
+		stats.processed = processed;
+		stats.dropped = dropped;
+		stats.deadlineMisses = deadlineMisses;
+		stats.stride = stride;
+		latency = latencies;
+		processing = processingTimes;
+
+		statsStart = now;
+		processed = 0;
+		dropped = 0;
+		deadlineMisses = 0;
+		latencies.reset();
+		processingTimes.reset();
+	}
+
+	stats.latencyP50 = percentileMs(latency, 0.50);
+	stats.latencyP90 = percentileMs(latency, 0.90);
+	stats.latencyP99 = percentileMs(latency, 0.99);
+	stats.latencyP999 = percentileMs(latency, 0.999);
+	stats.latencyMax = latency.max() * 1e-6;
+	stats.processingP50 = percentileMs(processing, 0.50);
+	stats.processingP99 = percentileMs(processing, 0.99);
+	stats.processingP999 = percentileMs(processing, 0.999);
+	return stats;
+}
+
+std::unique_ptr<FrameGovernor> createFrameGovernor(const StreamConfig& cfg, int frameInterval)
+{
+	double latencyBudget = 0;
+	if(cfg.exists("LatencyBudget", "General"))
+		latencyBudget = std::stod(cfg.value("LatencyBudget", "General"));
+
+	EDropPolicy policy = Drop_Stale;
+	std::string dropPolicy = cfg.value("DropPolicy", "General");
+	if(dropPolicy == "decimate")
+		policy = Drop_Decimate;
+	else if(dropPolicy == "none")
+		policy = Drop_None;
+	else if(!dropPolicy.empty() && dropPolicy != "stale")
+		std::cerr << "Unknown 'DropPolicy' parameter (must be none, stale or decimate), using stale\n";
+
+	return std::unique_ptr<FrameGovernor>(new FrameGovernor(frameInterval, latencyBudget, policy));
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "MonotonicClock.h"
+#include "LatencyHistogram.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+
+class StreamConfig;
+
+enum EDropPolicy
+{
+	Drop_None,    // process every frame, latency may grow
+	Drop_Stale,   // skip frames that can't make their deadline
+	Drop_Decimate // update model only every n-th frame, n adapts to load
+};
+
+//
+// Paces one stream and decides which grabbed frames are worth processing.
+// Every frame gets a capture timestamp and a deadline = capture + latency
+// budget. Capture time is the time the grab returned, or with frame interval
+// set the nominal slot of the frame (latest multiple of the interval not
+// after the grab, so it's never more than one interval early). Frames that
+// would miss the deadline are dropped (or model update rate is lowered)
+// instead of letting the backlog and latency grow without bound.
+//
+
+class FrameGovernor
+{
+public:
+	typedef MonotonicClock clock;
+
+	struct Stats
+	{
+		double fps;           // processed frames per second
+		int processed;
+		int dropped;
+		int deadlineMisses;   // processed frames that were late anyway
+		int stride;           // current decimation (1 - every frame)
+		double latencyP50;    // capture -> mask ready [ms]
+		double latencyP90;
+		double latencyP99;
+		double latencyP999;
+		double latencyMax;
+		double processingP50; // admit -> mask ready [ms]
+		double processingP99;
+		double processingP999;
+	};
+
+	// frameInterval [ms], 0 - frames are taken as they arrive
+	// latencyBudget [ms], 0 - no deadline (nothing is ever dropped)
+	FrameGovernor(int frameInterval, double latencyBudget, EDropPolicy policy);
+
+	// When next frame should be grabbed
+	clock::time_point nextFrameDue() const { return nextDue; }
+
+	// Called right after a frame was grabbed.
+	// Returns false if the frame should be skipped.
+	bool admit();
+
+	// Called when mask of the admitted frame is ready
+	void completed();
+
+	// Statistics gathered since last call (thread-safe)
+	Stats collectStats();
+
+private:
+	double elapsedMs(clock::time_point from, clock::time_point to) const
+	{
+		return std::chrono::duration<double, std::milli>(to - from).count();
+	}
+
+	static uint64_t elapsedNs(clock::time_point from, clock::time_point to)
+	{
+		return to > from ? uint64_t((to - from).count()) : 0;
+	}
+
+private:
+	std::chrono::milliseconds frameInterval;
+	double latencyBudget;
+	EDropPolicy policy;
+
+	clock::time_point nextDue;
+	clock::time_point captureTime;
+	clock::time_point admitTime;
+	double estimatedCost; // moving average of admit -> completed [ms]
+	// Changed by completed() on the worker, read by collectStats()
+	std::atomic<int> stride;
+	int frameIndex;
+	int slackFrames;
+
+	std::mutex statsMutex;
+	clock::time_point statsStart;
+	int processed;
+	int dropped;
+	int deadlineMisses;
+	LatencyHistogram latencies;
+	LatencyHistogram processingTimes;
+
+private:
+	FrameGovernor(const FrameGovernor&);
+	FrameGovernor& operator=(const FrameGovernor&);
+};
+
+// Reads LatencyBudget and DropPolicy of the stream
+std::unique_ptr<FrameGovernor> createFrameGovernor(const StreamConfig& cfg, int frameInterval);
@@ -1,4 +1,5 @@
 #include "FrameGrabber.h"
+#include "ConfigFile.h"
 
 #include <opencv2/highgui/highgui.hpp>
 #include <stdexcept>
@@ -42,16 +43,55 @@ bool OpenCvFrameGrabber::init(const std::string& stream)
 		return false;
 	}
 
-	// HACK
-	cv::Mat dummy;
-	cap >> dummy;
+	if(!probeFormat())
+	{
+		std::cerr << "Can't retrieve frame format of " << stream << ", qutting\n";
+		return false;
+	}
+
+	return true;
+}
+
+bool OpenCvFrameGrabber::probeFormat()
+{
+	probeFrame.release();
 
 	// Retrieve frame size
 	width = int(cap.get(CV_CAP_PROP_FRAME_WIDTH));
 	height = int(cap.get(CV_CAP_PROP_FRAME_HEIGHT));
-	
-	pixelDepth  = dummy.depth();
-	numChannels = dummy.channels();
+
+	// Backends that don't support CV_CAP_PROP_FORMAT report 0 which is 
+	// also CV_8UC1, so only trust it when it's something else. Some report
+	// values that aren't cv types at all (e.g. fourcc), these are ignored too.
+	int type = int(cap.get(CV_CAP_PROP_FORMAT));
+	bool convertRgb = cap.get(CV_CAP_PROP_CONVERT_RGB) != 0;
+	bool validType = type > 0 && (type & ~CV_MAT_TYPE_MASK) == 0 &&
+		CV_MAT_DEPTH(type) <= CV_64F &&
+		CV_MAT_CN(type) >= 1 && CV_MAT_CN(type) <= 4;
+
+	if(width > 0 && height > 0 && validType)
+	{
+		pixelDepth = CV_MAT_DEPTH(type);
+		numChannels = CV_MAT_CN(type);
+	}
+	else if(width > 0 && height > 0 && type <= 0 && convertRgb)
+	{
+		// Frames are converted to BGR by the backend
+		pixelDepth = CV_8U;
+		numChannels = 3;
+	}
+	else
+	{
+		// Container/device doesn't tell - decode first frame and keep it
+		cap >> probeFrame;
+		if(probeFrame.empty())
+			return false;
+
+		width = probeFrame.cols;
+		height = probeFrame.rows;
+		pixelDepth = probeFrame.depth();
+		numChannels = probeFrame.channels();
+	}
 
 	switch(pixelDepth)
 	{
@@ -77,13 +117,23 @@ bool OpenCvFrameGrabber::init(const std::string& stream)
 
 void OpenCvFrameGrabber::deinit()
 {
-	// nothing to do
+	probeFrame.release();
 }
 
 cv::Mat OpenCvFrameGrabber::grab(bool* success)
 {
 	cv::Mat frame;
-	cap >> frame;
+	if(!probeFrame.empty())
+	{
+		// Hand out frame decoded during init
+		frame = probeFrame;
+		probeFrame.release();
+	}
+	else
+	{
+		cap >> frame;
+	}
+
 	if(success != nullptr)
 	{
 		if(frame.rows == 0 || frame.cols == 0)
@@ -113,11 +163,19 @@ bool OpenCvFrameGrabber::needBayer() const
 #		pragma comment(lib, "SapClassBasic.lib")
 #	endif
 
-SaperaFrameGrabber::SaperaFrameGrabber()
+#include <chrono>
+
+SaperaFrameGrabber::SaperaFrameGrabber(int numBuffers,
+                                       EBitDepthWindow bitDepthWindow,
+                                       float gamma)
 	: acq(nullptr)
 	, buffer(nullptr)
 	, xfer(nullptr)
-	, image(nullptr)
+	, numBuffers(numBuffers > 2 ? numBuffers : 2)
+	, currentIndex(-1)
+	, filledBuffers(numBuffers > 2 ? numBuffers : 2)
+	, bitDepthWindow(bitDepthWindow)
+	, gamma(gamma)
 {
 }
 
@@ -131,9 +189,12 @@ bool SaperaFrameGrabber::init(const std::string& stream)
 	SapLocation loc("X64-CL_iPro_1", 0);
 	const char* cfg_file = stream.c_str();
 
+	// N buffers plus trash buffer - when all N buffers are still full
+	// (not yet consumed) new frame lands in trash instead of overwriting
+	// a buffer that is being processed
 	acq = new SapAcquisition(loc, cfg_file);
-	buffer = new SapBuffer(1, acq);
-	xfer = new SapAcqToBuf(acq, buffer);
+	buffer = new SapBufferWithTrash(numBuffers, acq);
+	xfer = new SapAcqToBuf(acq, buffer, &SaperaFrameGrabber::transferCallback, this);
 
 	// Crate acquisition object
 	if(acq && !acq->Create())
@@ -151,6 +212,10 @@ bool SaperaFrameGrabber::init(const std::string& stream)
 		return false;
 	}
 
+	// Buffers are emptied by us once the frame has been processed
+	xfer->SetAutoEmpty(FALSE);
+	xfer->GetPair(0)->SetCycleMode(SapXferPair::CycleNextWithTrash);
+
 	// Create transfer object
 	if (xfer && !xfer->Create())
 	{
@@ -162,21 +227,24 @@ bool SaperaFrameGrabber::init(const std::string& stream)
 	std::cout << "\n  Sapera initialized successfully:" 
 		<< "\n  Buffer pixel depth: " << buffer->GetPixelDepth()
 		<< "\n  Buffer bytes per pixel: " << buffer->GetBytesPerPixel()
+		<< "\n  Number of buffers: " << numBuffers
 		<< "\n\n";
 
-	// Not sure if that's ok
-	if(buffer->GetPixelDepth() > 8)
+	if(buffer->GetPixelDepth() > 8 && bitDepthWindow != BitDepth_Native)
 	{
 		// 10 or 12 bits
-		image = cvCreateImage(cvSize(buffer->GetWidth(), buffer->GetHeight()), IPL_DEPTH_16U, 1);
+		bitDepthConverter.init(buffer->GetWidth(), buffer->GetHeight(),
+			buffer->GetPixelDepth(), bitDepthWindow, gamma);
 	}
-	else
+
+	// Start continuous acquisition
+	if(!xfer->Grab())
 	{
-		// normal 8 bits
-		image = cvCreateImage(cvSize(buffer->GetWidth(), buffer->GetHeight()), IPL_DEPTH_8U, 1);
+		std::cout << "Grab error.\n";
+		deinit();
+		return false;
 	}
 
-	dummyImageData = image->imageData;
 	return true;
 }
 
@@ -206,13 +274,15 @@ void SaperaFrameGrabber::deinit()
 	if (buffer) delete buffer; 
 	if (acq) delete acq; 
 
-	image->imageData = dummyImageData;
-	cvReleaseImage(&image);
+	// Drop indices of buffers that are no longer there
+	int index;
+	while(filledBuffers.pop(&index))
+		;
 
 	acq = nullptr;
 	buffer = nullptr;
 	xfer = nullptr;
-	image = nullptr;
+	currentIndex = -1;
 }
 
 cv::Mat SaperaFrameGrabber::grab(bool* success)
@@ -224,25 +294,76 @@ cv::Mat SaperaFrameGrabber::grab(bool* success)
 		return cv::Mat();
 	}
 
-	// Grab a frame
-	bool ret = xfer->Snap() > 0;
-	ret &= xfer->Wait(1000) > 0;
+	// Previously returned frame is no longer used
+	releaseBuffer();
+
+	int index;
+	bool ret = waitForBuffer(&index, 1000);
 
-	void* data;
-	ret &= buffer->GetAddress(&data) > 0;
-	image->imageData = static_cast<char*>(data);
-	cv::Mat frame(image);
+	void* data = nullptr;
+	ret = ret && buffer->GetAddress(index, &data) > 0;
 
 	if(success)
 		*success = ret;
+	if(!ret)
+		return cv::Mat();
+
+	currentIndex = index;
+
+	// Wrap buffer memory, no copy
+	cv::Mat frame(buffer->GetHeight(), buffer->GetWidth(),
+		buffer->GetPixelDepth() > 8 ? CV_16UC1 : CV_8UC1,
+		data, buffer->GetPitch());
+
+	if(frame.depth() != CV_8U && bitDepthWindow != BitDepth_Native)
+		return bitDepthConverter.convert(frame);
+
+	return frame;
+}
 
-	if(frame.depth() != CV_8U)
+void SaperaFrameGrabber::transferCallback(SapXferCallbackInfo* info)
+{
+	// Frame went to trash buffer - all buffers are still being processed
+	if(info->IsTrash())
+		return;
+
+	SaperaFrameGrabber* self = static_cast<SaperaFrameGrabber*>(info->GetContext());
+	// After end of frame buffer index points at the buffer just filled
+	int index = self->buffer->GetIndex();
+
+	// Queue can hold index of every buffer so it can't really overflow,
+	// still, never block inside the callback
+	if(!self->filledBuffers.push(index))
 	{
-		cv::Mat tmp = frame.clone();
-		tmp.convertTo(frame, CV_8UC1, 0.0625);
+		self->buffer->SetState(index, SapBuffer::StateEmpty);
+		return;
 	}
 
-	return frame;
+	// Mutex is only taken to not lose the wakeup of grabbing thread
+	// that has just found the queue empty, it's never held for long
+	{
+		std::lock_guard<std::mutex> lock(self->filledMutex);
+	}
+	self->filledCondition.notify_one();
+}
+
+bool SaperaFrameGrabber::waitForBuffer(int* index, int timeoutMs)
+{
+	// Sleep until transfer callback publishes a buffer. Buffers are handed
+	// out in order of arrival, when we fall behind it's up to FrameGovernor
+	// to drop frames (and count them)
+	std::unique_lock<std::mutex> lock(filledMutex);
+	return filledCondition.wait_for(lock, std::chrono::milliseconds(timeoutMs),
+		[&] { return filledBuffers.pop(index); });
+}
+
+void SaperaFrameGrabber::releaseBuffer()
+{
+	if(currentIndex >= 0)
+	{
+		buffer->SetState(currentIndex, SapBuffer::StateEmpty);
+		currentIndex = -1;
+	}
 }
 
 int SaperaFrameGrabber::frameWidth() const
@@ -269,8 +390,13 @@ int SaperaFrameGrabber::frameNumChannels() const
 
 int SaperaFrameGrabber::framePixelDepth() const
 {
+	// Depth of frames returned by grab()
 	if(buffer)
-		return buffer->GetPixelDepth();
+	{
+		return bitDepthWindow == BitDepth_Native
+			? buffer->GetPixelDepth()
+			: (buffer->GetPixelDepth() > 8 ? 8 : buffer->GetPixelDepth());
+	}
 	return 0;
 }
 
@@ -284,4 +410,289 @@ bool SaperaFrameGrabber::needBayer() const
 	return true;
 }
 
-#endif
\ No newline at end of file
+#endif
+
+#if defined(FFMPEG_SUPPORT)
+
+extern "C" {
+#	include <libavformat/avformat.h>
+#	include <libavcodec/avcodec.h>
+#	include <libavutil/hwcontext.h>
+#	include <libavutil/pixdesc.h>
+}
+
+namespace
+{
+	AVPixelFormat ffmpegGetHwFormat(AVCodecContext* ctx, const AVPixelFormat* formats)
+	{
+		const int hwPixelFormat = *static_cast<const int*>(ctx->opaque);
+		for(const AVPixelFormat* p = formats; *p != AV_PIX_FMT_NONE; ++p)
+		{
+			if(*p == hwPixelFormat)
+				return *p;
+		}
+
+		std::cerr << "Hardware surface format not offered, falling back to software decoding\n";
+		return avcodec_default_get_format(ctx, formats);
+	}
+}
+
+FFmpegFrameGrabber::FFmpegFrameGrabber(int numThreads,
+                                       bool frameThreading,
+                                       const std::string& hwAccel)
+	: formatCtx(nullptr)
+	, codecCtx(nullptr)
+	, hwDeviceCtx(nullptr)
+	, frame(nullptr)
+	, swFrame(nullptr)
+	, packet(nullptr)
+	, streamIndex(-1)
+	, hwPixelFormat(AV_PIX_FMT_NONE)
+	, draining(false)
+	, numThreads(numThreads)
+	, frameThreading(frameThreading)
+	, hwAccel(hwAccel)
+	, width(0)
+	, height(0)
+	, pixelDepth(0)
+{
+}
+
+FFmpegFrameGrabber::~FFmpegFrameGrabber()
+{
+	deinit();
+}
+
+bool FFmpegFrameGrabber::init(const std::string& stream)
+{
+	if(avformat_open_input(&formatCtx, stream.c_str(), nullptr, nullptr) < 0)
+	{
+		std::cerr << "Can't load " << stream << ", qutting\n";
+		return false;
+	}
+
+	if(avformat_find_stream_info(formatCtx, nullptr) < 0)
+	{
+		std::cerr << "Can't find stream information in " << stream << "\n";
+		deinit();
+		return false;
+	}
+
+	streamIndex = av_find_best_stream(formatCtx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+	if(streamIndex < 0)
+	{
+		std::cerr << "No video stream in " << stream << "\n";
+		deinit();
+		return false;
+	}
+
+	AVStream* videoStream = formatCtx->streams[streamIndex];
+	const AVCodec* codec = avcodec_find_decoder(videoStream->codecpar->codec_id);
+	if(!codec)
+	{
+		std::cerr << "No decoder for " << stream << "\n";
+		deinit();
+		return false;
+	}
+
+	// Only formats with luma in its own plane can be handed out without conversion
+	const AVPixelFormat format = static_cast<AVPixelFormat>(videoStream->codecpar->format);
+	const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(format);
+	const int unsupportedFlags = AV_PIX_FMT_FLAG_RGB | AV_PIX_FMT_FLAG_PAL |
+		AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_BE;
+	if(!desc || (desc->flags & unsupportedFlags) || desc->comp[0].plane != 0 || 
+		desc->comp[0].step != (desc->comp[0].depth > 8 ? 2 : 1))
+	{
+		std::cerr << "Pixel format " << (desc ? desc->name : "unknown") 
+			<< " of " << stream << " has no separate luma plane\n";
+		deinit();
+		return false;
+	}
+	pixelDepth = desc->comp[0].depth;
+
+	codecCtx = avcodec_alloc_context3(codec);
+	avcodec_parameters_to_context(codecCtx, videoStream->codecpar);
+	codecCtx->thread_count = numThreads;
+	codecCtx->thread_type = frameThreading ? FF_THREAD_FRAME : FF_THREAD_SLICE;
+
+	if(!hwAccel.empty())
+	{
+		AVHWDeviceType type = av_hwdevice_find_type_by_name(hwAccel.c_str());
+		for(int i = 0; type != AV_HWDEVICE_TYPE_NONE; ++i)
+		{
+			const AVCodecHWConfig* config = avcodec_get_hw_config(codec, i);
+			if(!config)
+				break;
+			if((config->methods & AV_CODEC_HW_CONFIG_METHOD_HW_DEVICE_CTX) &&
+				config->device_type == type)
+			{
+				hwPixelFormat = config->pix_fmt;
+				break;
+			}
+		}
+
+		if(hwPixelFormat != AV_PIX_FMT_NONE &&
+			av_hwdevice_ctx_create(&hwDeviceCtx, type, nullptr, nullptr, 0) >= 0)
+		{
+			codecCtx->hw_device_ctx = av_buffer_ref(hwDeviceCtx);
+			codecCtx->opaque = &hwPixelFormat;
+			codecCtx->get_format = ffmpegGetHwFormat;
+
+			// Hardware surfaces (P010, P016) keep high bit depth samples in MSBs
+			if(pixelDepth > 8)
+				pixelDepth = 16;
+		}
+		else
+		{
+			std::cerr << "Hardware decoding " << hwAccel 
+				<< " not available, using software decoding\n";
+			hwPixelFormat = AV_PIX_FMT_NONE;
+		}
+	}
+
+	if(avcodec_open2(codecCtx, codec, nullptr) < 0)
+	{
+		std::cerr << "Can't open decoder for " << stream << "\n";
+		deinit();
+		return false;
+	}
+
+	width = codecCtx->width;
+	height = codecCtx->height;
+
+	frame = av_frame_alloc();
+	swFrame = av_frame_alloc();
+	packet = av_packet_alloc();
+	draining = false;
+
+	return true;
+}
+
+void FFmpegFrameGrabber::deinit()
+{
+	av_packet_free(&packet);
+	av_frame_free(&swFrame);
+	av_frame_free(&frame);
+	avcodec_free_context(&codecCtx);
+	avformat_close_input(&formatCtx);
+	av_buffer_unref(&hwDeviceCtx);
+
+	streamIndex = -1;
+	hwPixelFormat = AV_PIX_FMT_NONE;
+}
+
+cv::Mat FFmpegFrameGrabber::grab(bool* success)
+{
+	cv::Mat luma;
+	if(codecCtx && decodeFrame())
+		luma = lumaPlane(frame);
+
+	if(success != nullptr)
+		*success = !luma.empty();
+	return luma;
+}
+
+bool FFmpegFrameGrabber::decodeFrame()
+{
+	for(;;)
+	{
+		int ret = avcodec_receive_frame(codecCtx, frame);
+		if(ret == 0)
+			return true;
+		// End of stream or decoding error
+		if(ret != AVERROR(EAGAIN) || draining)
+			return false;
+
+		// Feed decoder with next packet of our video stream
+		if(av_read_frame(formatCtx, packet) < 0)
+		{
+			// Flush frames still buffered in decoder threads
+			draining = true;
+			avcodec_send_packet(codecCtx, nullptr);
+			continue;
+		}
+
+		if(packet->stream_index == streamIndex)
+			avcodec_send_packet(codecCtx, packet);
+		av_packet_unref(packet);
+	}
+}
+
+cv::Mat FFmpegFrameGrabber::lumaPlane(AVFrame* decoded)
+{
+	if(decoded->format == hwPixelFormat)
+	{
+		// Download surface (NV12/P010) - Y plane comes first
+		av_frame_unref(swFrame);
+		if(av_hwframe_transfer_data(swFrame, decoded, 0) < 0)
+			return cv::Mat();
+		decoded = swFrame;
+	}
+
+	// Wrap Y plane, no copy
+	return cv::Mat(decoded->height, decoded->width, 
+		pixelDepth > 8 ? CV_16UC1 : CV_8UC1,
+		decoded->data[0], decoded->linesize[0]);
+}
+
+int FFmpegFrameGrabber::frameWidth() const
+{ return width; }
+int FFmpegFrameGrabber::frameHeight() const
+{ return height; }
+int FFmpegFrameGrabber::frameNumChannels() const
+{ return 1; }
+int FFmpegFrameGrabber::framePixelDepth() const
+{ return pixelDepth; }
+bool FFmpegFrameGrabber::needBayer() const
+{ return false; }
+
+#endif
+
+std::unique_ptr<FrameGrabber> createFrameGrabber(const std::string& videoStream,
+                                                 const StreamConfig& cfg)
+{
+#if defined(SAPERA_SUPPORT)
+	// Sprawdz suffix videoStream (.ccf)
+	size_t pos = videoStream.find_last_of(".ccf");
+	if(pos+1 == videoStream.length())
+	{
+		int numBuffers = SaperaFrameGrabber::defaultNumBuffers;
+		if(cfg.exists("SaperaBuffers", "General"))
+			numBuffers = std::stoi(cfg.value("SaperaBuffers", "General"));
+
+		EBitDepthWindow bitDepthWindow = BitDepth_TopBits;
+		std::string bitDepthCfg = cfg.value("BitDepthWindow", "General");
+		if(bitDepthCfg == "autogain") bitDepthWindow = BitDepth_AutoGain;
+		else if(bitDepthCfg == "lut") bitDepthWindow = BitDepth_Lut;
+		else if(bitDepthCfg == "native") bitDepthWindow = BitDepth_Native;
+		float gamma = 1.0f;
+		if(cfg.exists("BitDepthGamma", "General"))
+			gamma = std::stof(cfg.value("BitDepthGamma", "General"));
+
+		return std::unique_ptr<FrameGrabber>(
+			new SaperaFrameGrabber(numBuffers, bitDepthWindow, gamma));
+	}
+#endif
+
+#if defined(FFMPEG_SUPPORT)
+	if(cfg.value("Decoder", "General") == "ffmpeg")
+	{
+		int numThreads = 0;
+		if(cfg.exists("DecoderThreads", "General"))
+			numThreads = std::stoi(cfg.value("DecoderThreads", "General"));
+		bool frameThreading = cfg.value("DecoderThreadType", "General") != "slice";
+
+		return std::unique_ptr<FrameGrabber>(new FFmpegFrameGrabber(
+			numThreads, frameThreading, cfg.value("HwAccel", "General")));
+	}
+#endif
+
+	// Parameters are used only by optional grabbers
+#if !defined(SAPERA_SUPPORT)
+	(void) videoStream;
+#endif
+#if !defined(SAPERA_SUPPORT) && !defined(FFMPEG_SUPPORT)
+	(void) cfg;
+#endif
+	return std::unique_ptr<FrameGrabber>(new OpenCvFrameGrabber());
+}
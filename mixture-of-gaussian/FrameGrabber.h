@@ -2,6 +2,9 @@
 
 #include <opencv2/highgui/highgui.hpp>
 #include <string>
+#include <memory>
+
+class StreamConfig;
 
 class FrameGrabber
 {
@@ -31,8 +34,14 @@ public:
 	virtual int framePixelDepth() const override;
 	virtual bool needBayer() const override;
 
+private:
+	bool probeFormat();
+
 private:
 	cv::VideoCapture cap;
+	// First frame if it had to be decoded to learn the format,
+	// returned by the first grab()
+	cv::Mat probeFrame;
 	int width,
 		height,
 		pixelDepth,
@@ -42,19 +51,32 @@ private:
 // Make sure it isn't included in Linux builds
 #if defined(SAPERA_SUPPORT) && defined(_WIN32)
 
+#include "SpscQueue.h"
+#include "BitDepthConverter.h"
+
+#include <condition_variable>
+#include <mutex>
+
 // Forward declarations
 class SapAcquisition;
 class SapBuffer;
 class SapAcqToBuf;
+class SapXferCallbackInfo;
 
 class SaperaFrameGrabber : public FrameGrabber
 {
 public:
-	SaperaFrameGrabber();
+	static const int defaultNumBuffers = 4;
+
+	SaperaFrameGrabber(int numBuffers = defaultNumBuffers,
+		EBitDepthWindow bitDepthWindow = BitDepth_TopBits,
+		float gamma = 1.0f);
 	virtual ~SaperaFrameGrabber();
 
 	virtual bool init(const std::string& stream) override;
 	virtual void deinit() override;
+	// Returned frame points straight into Sapera buffer memory
+	// and stays valid only until the next call to grab()
 	virtual cv::Mat grab(bool* success) override;
 	virtual int frameWidth() const override;
 	virtual int frameHeight() const override;
@@ -62,12 +84,93 @@ public:
 	virtual int framePixelDepth() const override;
 	virtual bool needBayer() const override;
 
+private:
+	static void transferCallback(SapXferCallbackInfo* info);
+	bool waitForBuffer(int* index, int timeoutMs);
+	void releaseBuffer();
+
 private:
 	SapAcquisition* acq;
 	SapBuffer* buffer;
 	SapAcqToBuf* xfer;
-	IplImage* image; // Can't really use cv::Mat
-	char* dummyImageData;
+	int numBuffers;
+	int currentIndex; // buffer handed out by last grab(), -1 if none
+
+	// Indices of filled buffers published by transfer callback
+	SpscQueue<int> filledBuffers;
+	// Signalled after every push to filledBuffers
+	std::mutex filledMutex;
+	std::condition_variable filledCondition;
+	// Used only for cameras with more than 8 bits per pixel
+	BitDepthConverter bitDepthConverter;
+	EBitDepthWindow bitDepthWindow;
+	float gamma;
+};
+
+#endif
+
+#if defined(FFMPEG_SUPPORT)
+
+// Forward declarations
+struct AVFormatContext;
+struct AVCodecContext;
+struct AVFrame;
+struct AVPacket;
+struct AVBufferRef;
+
+//
+// Decodes straight to YUV and hands out only luma (Y) plane as gray frame,
+// without any YUV->BGR->gray conversions. 
+//
+
+class FFmpegFrameGrabber : public FrameGrabber
+{
+public:
+	// numThreads = 0 lets FFmpeg pick number of decoding threads
+	// hwAccel - name of FFmpeg hw device type (e.g. dxva2, vaapi, cuda) or empty
+	FFmpegFrameGrabber(int numThreads = 0, bool frameThreading = true,
+		const std::string& hwAccel = std::string());
+	virtual ~FFmpegFrameGrabber();
+
+	virtual bool init(const std::string& stream) override;
+	virtual void deinit() override;
+	// Returned frame points into decoder's frame
+	// and stays valid only until the next call to grab()
+	virtual cv::Mat grab(bool* success) override;
+	virtual int frameWidth() const override;
+	virtual int frameHeight() const override;
+	virtual int frameNumChannels() const override;
+	virtual int framePixelDepth() const override;
+	virtual bool needBayer() const override;
+
+private:
+	bool decodeFrame();
+	cv::Mat lumaPlane(AVFrame* frame);
+
+private:
+	AVFormatContext* formatCtx;
+	AVCodecContext* codecCtx;
+	AVBufferRef* hwDeviceCtx;
+	AVFrame* frame;
+	AVFrame* swFrame;
+	AVPacket* packet;
+	int streamIndex;
+	int hwPixelFormat;
+	bool draining;
+
+	int numThreads;
+	bool frameThreading;
+	std::string hwAccel;
+
+	int width,
+		height,
+		pixelDepth;
 };
 
-#endif
\ No newline at end of file
+#endif
+
+// Creates grabber suitable for given video stream: 
+// Sapera for camera configuration files (.ccf), FFmpeg (if enabled in config)
+// or OpenCV for everything else
+std::unique_ptr<FrameGrabber> createFrameGrabber(const std::string& videoStream,
+	const StreamConfig& cfg);
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "GrayscaleGPU.h"
+#include "WorkGroupTuner.h"
 
 #include <iostream>
 
@@ -14,9 +15,11 @@ GrayscaleGPU::GrayscaleGPU(const clw::Context& context,
 void GrayscaleGPU::init(int imageWidth,
 						int imageHeight,
 						int workGroupSizeX,
-						int workGroupSizeY)
+						int workGroupSizeY,
+						EChannelOrder channelOrder,
+						EColorLayout layout)
 {
-	createRgb2GrayKernel();
+	createRgb2GrayKernel(channelOrder, layout);
 	createOutputImage(imageWidth, imageHeight);
 
 	width = imageWidth;
@@ -25,7 +28,7 @@ void GrayscaleGPU::init(int imageWidth,
 
 	// Ustawienie argumentow i parametrow kerneli
 	kernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
-	kernel.setRoundedGlobalWorkSize(width, height);
+	setGlobalWorkSize();
 	kernel.setArg(1, outputImage);
 	kernel.setArg(2, frameSize);
 }
@@ -36,10 +39,32 @@ void GrayscaleGPU::setKernelWorkGroupSize(int workGroupSizeX,
 	if(!kernel.isNull())
 	{
 		kernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
-		kernel.setRoundedGlobalWorkSize(width, height);
+		setGlobalWorkSize();
 	}
 }
 
+void GrayscaleGPU::setGlobalWorkSize()
+{
+	kernel.setRoundedGlobalWorkSize(globalWidth(), height);
+}
+
+int GrayscaleGPU::globalWidth() const
+{
+	// Every work-item converts 4 pixels of a row
+	return (width + 3) / 4;
+}
+
+void GrayscaleGPU::tuneWorkGroupSize(WorkGroupTuner& tuner,
+                                     clw::Buffer& sampleInput,
+                                     int* workGroupSizeX,
+                                     int* workGroupSizeY)
+{
+	tuner.tune(device, kernel, kernelName, globalWidth(), height, queue,
+		[this](int x, int y) { setKernelWorkGroupSize(x, y); },
+		[&] { return process(sampleInput); },
+		workGroupSizeX, workGroupSizeY);
+}
+
 clw::Event GrayscaleGPU::process(clw::Buffer& inputImage)
 {
 	if(kernel.isNull())
@@ -48,16 +73,19 @@ clw::Event GrayscaleGPU::process(clw::Buffer& inputImage)
 	return queue.asyncRunKernel(kernel);
 }
 
-void GrayscaleGPU::createRgb2GrayKernel()
+void GrayscaleGPU::createRgb2GrayKernel(EChannelOrder channelOrder,
+                                        EColorLayout layout)
 {
 	clw::Program progCvt = context.createProgramFromSourceFile("color-conversion.cl");
-	if(!progCvt.build())
+	if(!progCvt.build(channelOrder == ChannelOrder_RGB ? "-DRGB_ORDER" : ""))
 	{
 		std::cout << progCvt.log();
 		std::exit(-1);
 	}
 	std::cout << progCvt.log();
-	kernel = progCvt.createKernel("rgb2gray_image");
+
+	kernelName = layout == ColorLayout_Padded ? "rgbx2gray_image" : "rgb2gray_image";
+	kernel = progCvt.createKernel(kernelName);
 }
 
 void GrayscaleGPU::createOutputImage(int width,
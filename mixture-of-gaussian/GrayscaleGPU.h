@@ -1,6 +1,22 @@
 #pragma once
 
 #include <clw/clw.h>
+#include <string>
+
+class WorkGroupTuner;
+
+// Order of color components in memory
+enum EChannelOrder
+{
+	ChannelOrder_BGR, // as OpenCV delivers frames
+	ChannelOrder_RGB
+};
+
+enum EColorLayout
+{
+	ColorLayout_Packed, // 3 bytes per pixel
+	ColorLayout_Padded  // 4 bytes per pixel (BGRX/BGRA), 4th one is ignored
+};
 
 class GrayscaleGPU
 {
@@ -9,16 +25,28 @@ public:
 		const clw::Device& device,
 		const clw::CommandQueue& queue);
 
+	// Padded layout lets every work-item load its 4 pixels
+	// with one aligned vload16 (packed needs vload8 + vload4)
 	void init(int imageWidth, int imageHeight,
-		int workGroupSizeX, int workGroupSizeY);
+		int workGroupSizeX, int workGroupSizeY,
+		EChannelOrder channelOrder = ChannelOrder_BGR,
+		EColorLayout layout = ColorLayout_Packed);
 
 	void setKernelWorkGroupSize(int workGroupSizeX, int workGroupSizeY);
 
+	// Finds best local size running the kernel on sampleInput (on first
+	// use per device and frame size).
+	// workGroupSizeX/Y - in: default size, out: size being used
+	void tuneWorkGroupSize(WorkGroupTuner& tuner, clw::Buffer& sampleInput,
+		int* workGroupSizeX, int* workGroupSizeY);
+
 	clw::Event process(clw::Buffer& inputImage);
 	clw::Image2D output() const { return outputImage; }
 
 private:
-	void createRgb2GrayKernel();
+	void createRgb2GrayKernel(EChannelOrder channelOrder, EColorLayout layout);
+	void setGlobalWorkSize();
+	int globalWidth() const;
 	void createOutputImage(int width, int height);
 
 private:
@@ -27,6 +55,7 @@ private:
 	clw::CommandQueue queue;
 	clw::Kernel kernel;
 	clw::Image2D outputImage;
+	std::string kernelName;
 	int width;
 	int height;
 
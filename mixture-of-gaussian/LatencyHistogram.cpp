@@ -0,0 +1,106 @@
+#include "LatencyHistogram.h"
+
+namespace
+{
+	// Values below 2^subBucketBits are exact, every higher power of two
+	// range is split into 2^(subBucketBits - 1) linear sub-buckets
+	const int subBucketBits = 5;
+	const int subBucketCount = 1 << subBucketBits;
+	const int subBucketHalf = subBucketCount / 2;
+	// Values up to 2^maxBits ns (~18 minutes) are tracked, larger are clamped
+	const int maxBits = 40;
+	const int maxShift = maxBits - subBucketBits;
+	const int numBuckets = subBucketCount + maxShift * subBucketHalf;
+
+	int highestBit(uint64_t value)
+	{
+		int bit = 0;
+		while(value >>= 1)
+			++bit;
+		return bit;
+	}
+}
+
+LatencyHistogram::LatencyHistogram()
+	: buckets(numBuckets, 0)
+	, total(0)
+	, maxValue(0)
+	, sum(0)
+{
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+	++buckets[bucketIndex(nanoseconds)];
+	++total;
+	sum += double(nanoseconds);
+	if(nanoseconds > maxValue)
+		maxValue = nanoseconds;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for(int i = 0; i < numBuckets; ++i)
+		buckets[i] += other.buckets[i];
+	total += other.total;
+	sum += other.sum;
+	if(other.maxValue > maxValue)
+		maxValue = other.maxValue;
+}
+
+void LatencyHistogram::reset()
+{
+	buckets.assign(numBuckets, 0);
+	total = 0;
+	maxValue = 0;
+	sum = 0;
+}
+
+double LatencyHistogram::mean() const
+{
+	return total > 0 ? sum / double(total) : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+	if(total == 0)
+		return 0;
+
+	uint64_t rank = uint64_t(p * double(total - 1) + 0.5) + 1;
+	uint64_t seen = 0;
+	for(int i = 0; i < numBuckets; ++i)
+	{
+		seen += buckets[i];
+		if(seen >= rank)
+		{
+			uint64_t value = bucketValue(i);
+			return value < maxValue ? value : maxValue;
+		}
+	}
+	return maxValue;
+}
+
+int LatencyHistogram::bucketIndex(uint64_t value)
+{
+	if(value < uint64_t(subBucketCount))
+		return int(value);
+
+	int shift = highestBit(value) - subBucketBits + 1;
+	if(shift > maxShift)
+		return numBuckets - 1;
+
+	// value >> shift is in [subBucketHalf, subBucketCount)
+	int sub = int(value >> shift) - subBucketHalf;
+	return subBucketCount + (shift - 1) * subBucketHalf + sub;
+}
+
+uint64_t LatencyHistogram::bucketValue(int index)
+{
+	if(index < subBucketCount)
+		return uint64_t(index);
+
+	// Middle of the bucket
+	int shift = (index - subBucketCount) / subBucketHalf + 1;
+	uint64_t sub = uint64_t((index - subBucketCount) % subBucketHalf + subBucketHalf);
+	return (sub << shift) + (uint64_t(1) << shift) / 2;
+}
\ No newline at end of file
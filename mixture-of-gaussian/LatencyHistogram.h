@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+//
+// HDR-style histogram of durations in nanoseconds: every power of two
+// range is split into the same number of linear sub-buckets, so relative
+// error stays constant (~3%) from nanoseconds up to minutes, with fixed
+// memory and O(1) recording. Not thread-safe, use one per thread/stream.
+//
+
+class LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void record(uint64_t nanoseconds);
+	void merge(const LatencyHistogram& other);
+	void reset();
+
+	uint64_t count() const { return total; }
+	uint64_t max() const { return maxValue; }
+	double mean() const;
+	// p in [0, 1], e.g. 0.999
+	uint64_t percentile(double p) const;
+
+private:
+	static int bucketIndex(uint64_t value);
+	static uint64_t bucketValue(int index);
+
+private:
+	std::vector<uint64_t> buckets;
+	uint64_t total;
+	uint64_t maxValue;
+	double sum;
+};
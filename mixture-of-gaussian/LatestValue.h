@@ -0,0 +1,45 @@
+#pragma once
+
+#include <mutex>
+
+//
+// Single-slot mailbox: producer overwrites, consumer always gets
+// the most recent value and never waits for a slow producer
+//
+
+template<typename T>
+class LatestValue
+{
+public:
+	LatestValue()
+		: version(0)
+	{
+	}
+
+	void publish(const T& newValue)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		value = newValue;
+		++version;
+	}
+
+	// Returns false if nothing new has been published since lastVersion
+	bool fetch(T* out, unsigned long long* lastVersion) const
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(version == *lastVersion)
+			return false;
+		*out = value;
+		*lastVersion = version;
+		return true;
+	}
+
+private:
+	mutable std::mutex mutex;
+	T value;
+	unsigned long long version;
+
+private:
+	LatestValue(const LatestValue&);
+	LatestValue& operator=(const LatestValue&);
+};
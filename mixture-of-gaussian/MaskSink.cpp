@@ -0,0 +1,64 @@
+#include "MaskSink.h"
+#include "ConfigFile.h"
+
+#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <sstream>
+
+void NullMaskSink::consume(const std::string&, int, const cv::Mat&)
+{
+	// nothing
+}
+
+ImageFileMaskSink::ImageFileMaskSink(const std::string& directory,
+                                     int everyNthFrame)
+	: directory(directory)
+	, everyNthFrame(std::max(everyNthFrame, 1))
+{
+}
+
+void ImageFileMaskSink::consume(const std::string& stream,
+                                int frameNumber,
+                                const cv::Mat& mask)
+{
+	if(frameNumber % everyNthFrame != 0)
+		return;
+
+	// Stream name may be a path, keep only safe characters
+	std::string name = stream;
+	for(auto& c : name)
+	{
+		if(!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_')
+			c = '_';
+	}
+
+	std::ostringstream ss;
+	ss << directory << "/" << name << "_" << frameNumber << ".png";
+	if(!cv::imwrite(ss.str(), mask))
+		std::cerr << "Can't write " << ss.str() << "\n";
+}
+
+std::unique_ptr<MaskSink> createMaskSink(ConfigFile& cfg)
+{
+	std::string sink = cfg.value("MaskSink", "Headless");
+
+	if(sink == "files")
+	{
+		std::string directory = cfg.value("MaskDirectory", "Headless");
+		if(directory.empty())
+			directory = ".";
+		int everyNthFrame = 1;
+		if(cfg.exists("MaskEveryNthFrame", "Headless"))
+			everyNthFrame = std::stoi(cfg.value("MaskEveryNthFrame", "Headless"));
+
+		return std::unique_ptr<MaskSink>(new ImageFileMaskSink(directory, everyNthFrame));
+	}
+	else if(!sink.empty() && sink != "none")
+	{
+		std::cerr << "Unknown 'MaskSink' parameter (must be none or files), discarding masks\n";
+	}
+
+	return std::unique_ptr<MaskSink>(new NullMaskSink());
+}
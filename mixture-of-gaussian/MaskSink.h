@@ -0,0 +1,40 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <memory>
+#include <string>
+
+class ConfigFile;
+
+//
+// Destination for foreground masks in headless mode
+//
+
+class MaskSink
+{
+public:
+	virtual ~MaskSink() {}
+	virtual void consume(const std::string& stream, int frameNumber, const cv::Mat& mask) = 0;
+};
+
+// Discards masks (e.g. for throughput measurements)
+class NullMaskSink : public MaskSink
+{
+public:
+	virtual void consume(const std::string& stream, int frameNumber, const cv::Mat& mask) override;
+};
+
+// Writes every n-th mask as image file <directory>/<stream>_<frame>.png
+class ImageFileMaskSink : public MaskSink
+{
+public:
+	ImageFileMaskSink(const std::string& directory, int everyNthFrame);
+	virtual void consume(const std::string& stream, int frameNumber, const cv::Mat& mask) override;
+
+private:
+	std::string directory;
+	int everyNthFrame;
+};
+
+// Creates sink selected by MaskSink key in [Headless] section
+std::unique_ptr<MaskSink> createMaskSink(ConfigFile& cfg);
@@ -1,40 +1,100 @@
 #include "MixtureOfGaussianCPU.h"
+#include "RegionOfInterest.h"
+
+#include <cstring>
 
 #ifdef HAVE_TBB
 #include <tbb/tbb.h>
 #endif
 
-MixtureOfGaussianCPU::MixtureOfGaussianCPU(int rows, int cols, int history)
+namespace
+{
+	// Rows produced at once by RowProducer (small enough to stay in L1/L2)
+	const int producerBandRows = 8;
+}
+
+MixtureOfGaussianCPU::MixtureOfGaussianCPU(int rows, int cols, int history,
+	int pixelDepth, int nmixtures)
 	: rows(rows)
 	, cols(cols)
-	, nmixtures(defaultNumMixtures)
+	, nmixtures(std::min(std::max(nmixtures, 1), maxNumMixtures))
 	, history(history)
 	, nframe(0)
+	, numThreads(0)
+	, pixelDepth(std::min(std::max(pixelDepth, 8), 16))
 	, backgroundRatio(defaultBackgroundRatio)
 	, varThreshold(defaultVarianceThreshold)
-	, noiseSigma(defaultNoiseSigma)
 	, initialWeight(defaultInitialWeight)
+	, initialVariance(defaultNoiseSigma * defaultNoiseSigma * 4) // 900.0 lub 50.0f
+	, minVariance(defaultNoiseSigma * defaultNoiseSigma) // 225.0
+	, roi(nullptr)
+	, poolJob(nullptr)
+	, poolBands(0)
+	, poolPending(0)
+	, poolGeneration(0)
+	, poolStop(false)
+{
+	const float rangeScale = float((1 << this->pixelDepth) - 1) / 255.0f;
+	varianceScale = rangeScale * rangeScale;
+
+	allocateModel(cols * rows);
+}
+
+MixtureOfGaussianCPU::~MixtureOfGaussianCPU()
+{
+	stopPool();
+}
+
+void MixtureOfGaussianCPU::allocateModel(int npixels)
 {
 	// Gaussian mixtures data
-	int mix_data_size = cols * rows * nmixtures;
+	int mix_data_size = std::max(npixels, 1) * nmixtures;
 	bgmodel.create(1, mix_data_size * sizeof(MixtureData) / sizeof(float), CV_32F);
 	bgmodel = cv::Scalar::all(0);
 }
 
+void MixtureOfGaussianCPU::setRegionOfInterest(const RegionOfInterest* roi)
+{
+	CV_Assert(!roi || (roi->width() == cols && roi->height() == rows));
+	this->roi = roi && !roi->isFullFrame() ? roi : nullptr;
+	allocateModel(this->roi ? this->roi->numPixels() : cols * rows);
+}
+
+MixtureData* MixtureOfGaussianCPU::modelRow(int y)
+{
+	const int offset = roi ? roi->rowOffset(y) : y * cols;
+	return bgmodel.ptr<MixtureData>() + offset * nmixtures;
+}
+
 void MixtureOfGaussianCPU::operator() (cv::InputArray in, cv::OutputArray out,
 	float learningRate)
 {
 	cv::Mat frame = in.getMat();
-
-	++nframe;
-	float alpha = learningRate >= 0 && nframe > 1 
-		? learningRate
-		: 1.0f/std::min(nframe, history);
-
 	out.create(frame.size(), CV_8U);
 	cv::Mat mask = out.getMat();
 
-	calc_impl(frame.data, mask.data, bgmodel.ptr<MixtureData>(), alpha);
+	processRows(frame, mask, 0, rows, learningRate);
+}
+
+void MixtureOfGaussianCPU::processRows(const cv::Mat& frame, cv::Mat& mask,
+	int firstRow, int endRow, float learningRate)
+{
+	processRows(frame, mask, firstRow, endRow, learningRate, RowProducer());
+}
+
+void MixtureOfGaussianCPU::processRows(const cv::Mat& frame, cv::Mat& mask,
+	int firstRow, int endRow, float learningRate,
+	const RowProducer& produceRows)
+{
+	CV_Assert(frame.depth() == (pixelDepth > 8 ? CV_16U : CV_8U));
+	CV_Assert(firstRow >= 0 && firstRow <= endRow && endRow <= rows);
+
+	float alpha = nextAlpha(learningRate);
+
+	if(pixelDepth > 8)
+		calc_impl<ushort>(frame, mask, firstRow, endRow, alpha, produceRows);
+	else
+		calc_impl<uchar>(frame, mask, firstRow, endRow, alpha, produceRows);
 }
 
 void MixtureOfGaussianCPU::reinitialize(float backgroundRatio)
@@ -43,14 +103,100 @@ void MixtureOfGaussianCPU::reinitialize(float backgroundRatio)
 	bgmodel = cv::Scalar::all(0);
 }
 
-void MixtureOfGaussianCPU::calc_pix_impl(uchar src, uchar* dst, 
+void MixtureOfGaussianCPU::setMixtureParameters(float varianceThreshold,
+	float backgroundRatio, float initialWeight,
+	float initialVariance, float minVariance)
+{
+	this->varThreshold = varianceThreshold;
+	this->backgroundRatio = backgroundRatio;
+	this->initialWeight = initialWeight;
+	this->initialVariance = initialVariance;
+	this->minVariance = minVariance;
+}
+
+void MixtureOfGaussianCPU::setNumThreads(int numThreads)
+{
+	// Spawning threads for every frame costs about as much as the frame
+	stopPool();
+	this->numThreads = std::max(numThreads, 0);
+	if(this->numThreads > 1)
+		startPool(this->numThreads - 1);
+}
+
+void MixtureOfGaussianCPU::startPool(int numWorkers)
+{
+	poolStop = false;
+	// Threads wait for jobs posted after they were created
+	for(int i = 0; i < numWorkers; ++i)
+		pool.emplace_back(&MixtureOfGaussianCPU::poolThread, this, i + 1, poolGeneration);
+}
+
+void MixtureOfGaussianCPU::stopPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		poolStop = true;
+	}
+	poolWake.notify_all();
+	for(auto& thread : pool)
+		thread.join();
+	pool.clear();
+}
+
+void MixtureOfGaussianCPU::poolThread(int band, unsigned generation)
+{
+	std::unique_lock<std::mutex> lock(poolMutex);
+	for(;;)
+	{
+		poolWake.wait(lock, [&] { return poolStop || poolGeneration != generation; });
+		if(poolStop)
+			return;
+		generation = poolGeneration;
+		if(band >= poolBands)
+			continue;
+
+		const std::function<void(int)>& job = *poolJob;
+		lock.unlock();
+		job(band);
+		lock.lock();
+
+		if(--poolPending == 0)
+			poolDone.notify_one();
+	}
+}
+
+void MixtureOfGaussianCPU::runBands(int numBands, const std::function<void(int)>& band)
+{
+	{
+		std::lock_guard<std::mutex> lock(poolMutex);
+		poolJob = &band;
+		poolBands = numBands;
+		poolPending = numBands - 1;
+		++poolGeneration;
+	}
+	poolWake.notify_all();
+
+	band(0);
+
+	std::unique_lock<std::mutex> lock(poolMutex);
+	poolDone.wait(lock, [&] { return poolPending == 0; });
+}
+
+float MixtureOfGaussianCPU::nextAlpha(float learningRate)
+{
+	++nframe;
+	return learningRate >= 0 && nframe > 1 
+		? learningRate
+		: 1.0f/std::min(nframe, history);
+}
+
+void MixtureOfGaussianCPU::calc_pix_impl(float pix, uchar* dst, 
 	MixtureData mptr[], float alpha)
 {
 	const float w0 = initialWeight; // 0.05 lub 0.001
-	const float var0 = (noiseSigma*noiseSigma*4); // 900.0 lub 50.0f
-	const float minVar = (noiseSigma*noiseSigma); // 225.0
+	const float var0 = initialVariance * varianceScale;
+	const float minVar = minVariance * varianceScale;
 
-	float pix = static_cast<float>(src);
 	int pdfMatched = -1;
 
 	for(int mix = 0; mix < nmixtures; ++mix)
@@ -98,9 +244,8 @@ void MixtureOfGaussianCPU::calc_pix_impl(uchar src, uchar* dst,
 				float diff = pix - mu;
 				float var = mptr[mix].var;
 
-				//static const float PI = 3.14159265358979323846f;
-				//float ni = 1.0f / sqrtf(2.0f * PI * var) * expf(-0.5f * diff*diff / var);
-
+				// Must stay the same as mog_pixel built with HOST_UPDATE_RULE
+				// (mixture-of-gaussian.cl), used by hybrid worker
 				mptr[mix].weight = weight + alpha * (1 - weight);
 				mptr[mix].mean = mu + alpha * diff;
 				mptr[mix].var = std::max(minVar, var + alpha * (diff*diff - var));
@@ -122,7 +267,7 @@ void MixtureOfGaussianCPU::calc_pix_impl(uchar src, uchar* dst,
 		weightSum += mptr[mix].weight;
 
 	float invSum = 1.0f / weightSum;
-	float sortKey[5];
+	float sortKey[maxNumMixtures];
 	for(int mix = 0; mix < nmixtures; ++mix)
 	{
 		mptr[mix].weight *= invSum;
@@ -176,37 +321,74 @@ void MixtureOfGaussianCPU::calc_pix_impl(uchar src, uchar* dst,
 	}
 }
 
-void MixtureOfGaussianCPU::calc_impl(uchar* frame, uchar* mask,
-	MixtureData* mptr, float alpha)
+template<typename T>
+void MixtureOfGaussianCPU::calc_impl(const cv::Mat& frame, cv::Mat& mask,
+	int firstRow, int endRow, float alpha,
+	const RowProducer& produceRows)
 {
-#ifndef HAVE_TBB
-
-	for(int y = 0; y < rows; ++y)
+	auto processRange = [&](int beginRow, int endRow)
 	{
-		const uchar* src = &frame[y * cols];
-		uchar* dst = &mask[y * cols];
+		MixtureData* mptr = modelRow(beginRow);
 
-		for(int x = 0; x < cols; ++x, mptr += nmixtures)
-		{
-			calc_pix_impl(src[x], &dst[x], mptr, alpha);
-		}
-	}
-#else
-	tbb::parallel_for(tbb::blocked_range<int>(0, rows),
-		[&](const tbb::blocked_range<int>& range)
+		for(int bandRow = beginRow; bandRow < endRow; bandRow += producerBandRows)
 		{
-			MixtureData* mptr_local = mptr + range.begin() * cols * nmixtures;
+			const int bandEnd = std::min(bandRow + producerBandRows, endRow);
+			if(produceRows)
+				produceRows(bandRow, bandEnd);
 
-			for(int y = range.begin(); y < range.end(); ++y)
+			for(int y = bandRow; y < bandEnd; ++y)
 			{
-				const uchar* src = &frame[y * cols];
-				uchar* dst = &mask[y * cols];
+				// Rows of decoded frames may be padded
+				const T* src = frame.ptr<T>(y);
+				uchar* dst = mask.ptr<uchar>(y);
 
-				for(int x = 0; x < cols; ++x, mptr_local += nmixtures)
+				if(!roi)
 				{
-					calc_pix_impl(src[x], &dst[x], mptr_local, alpha);
+					for(int x = 0; x < cols; ++x, mptr += nmixtures)
+						calc_pix_impl(static_cast<float>(src[x]), &dst[x], mptr, alpha);
+					continue;
 				}
+
+				// Only spans of region of interest, gaps are background
+				const RegionOfInterest::Span* spans = roi->rowSpans(y);
+				const int numSpans = roi->numRowSpans(y);
+				int gapBegin = 0;
+				for(int i = 0; i < numSpans; ++i)
+				{
+					memset(dst + gapBegin, 0, spans[i].x0 - gapBegin);
+					for(int x = spans[i].x0; x < spans[i].x1; ++x, mptr += nmixtures)
+						calc_pix_impl(static_cast<float>(src[x]), &dst[x], mptr, alpha);
+					gapBegin = spans[i].x1;
+				}
+				memset(dst + gapBegin, 0, cols - gapBegin);
 			}
-		});
+		}
+	};
+
+#ifdef HAVE_TBB
+	if(numThreads == 0)
+	{
+		tbb::parallel_for(tbb::blocked_range<int>(firstRow, endRow),
+			[&](const tbb::blocked_range<int>& range)
+			{
+				processRange(range.begin(), range.end());
+			});
+		return;
+	}
 #endif
-}
\ No newline at end of file
+
+	// Every thread takes a band of rows (pixels are independent)
+	const int numRows = endRow - firstRow;
+	const int numBands = std::min(std::max(numThreads, 1), std::max(numRows, 1));
+	if(numBands == 1)
+	{
+		processRange(firstRow, endRow);
+		return;
+	}
+
+	runBands(numBands, [&](int band)
+	{
+		processRange(firstRow + numRows * band / numBands,
+			firstRow + numRows * (band + 1) / numBands);
+	});
+}
@@ -1,9 +1,18 @@
 #pragma once
 
 #include <opencv2/core/core.hpp>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class RegionOfInterest;
 
 //
-// Currenty unused, was used only during tests
+// Host implementation of the same MoG as mixture-of-gaussian.cl. Used for
+// frames OpenCV's MoG can't take (more than 8 bits, region of interest),
+// for host rows of hybrid worker and as reference in mog-bench.
 //
 
 static const int defaultNumMixtures = 5;
@@ -12,6 +21,7 @@ static const float defaultBackgroundRatio = 0.7f;
 static const float defaultVarianceThreshold = 2.5f * 2.5f;
 static const float defaultNoiseSigma = 30.0f * 0.5f;
 static const float defaultInitialWeight = 0.05f;
+static const int maxNumMixtures = 8;
 
 struct MixtureData
 {
@@ -35,18 +45,68 @@ struct MixtureData
 class MixtureOfGaussianCPU
 {
 public:
+	// pixelDepth - number of significant bits of input pixels (8 to 16),
+	// frames with more than 8 bits must be passed as CV_16U
 	MixtureOfGaussianCPU(int rows, int cols,
-		int history = defaultHistory);
+		int history = defaultHistory,
+		int pixelDepth = 8,
+		int nmixtures = defaultNumMixtures);
+	~MixtureOfGaussianCPU();
 
 	void operator() (cv::InputArray in, cv::OutputArray out,
 		float learningRate = 0.0f);
 	void reinitialize(float backgroundRatio);
 
+	// Same meaning as in MixtureOfGaussianGPU, variances for 8 bits pixel range
+	void setMixtureParameters(float varianceThreshold,
+		float backgroundRatio,
+		float initialWeight,
+		float initialVariance,
+		float minVariance);
+
+	// 0 - TBB's choice when built with it, otherwise single thread;
+	// n - rows are split in n bands, each on its own thread
+	// (n - 1 threads are kept by the engine, the caller takes one band)
+	void setNumThreads(int numThreads);
+
+	// Updates model and mask only in rows [firstRow, endRow),
+	// mask must be already allocated (CV_8U, size of frame)
+	void processRows(const cv::Mat& frame, cv::Mat& mask,
+		int firstRow, int endRow, float learningRate = 0.0f);
+
+	// Called with [bandFirst, bandEnd) right before a band of frame rows
+	// is modelled, so input can be produced while it's still in cache.
+	// Bands are disjoint but may be requested from several threads.
+	typedef std::function<void(int bandFirst, int bandEnd)> RowProducer;
+	// Same as above, frame rows are filled in by produceRows on the way
+	void processRows(const cv::Mat& frame, cv::Mat& mask,
+		int firstRow, int endRow, float learningRate,
+		const RowProducer& produceRows);
+
+	// Models only pixels of roi (must outlive the engine), the rest of mask
+	// is background. Model is reallocated for them and reset. nullptr - whole frame
+	void setRegionOfInterest(const RegionOfInterest* roi);
+
+	// Mixtures of modelled pixels of given row (numMixtures() entries per
+	// pixel), rows follow each other
+	MixtureData* modelRow(int y);
+	int numMixtures() const { return nmixtures; }
+
 private:
-	void calc_pix_impl(uchar src, uchar* dst,
+	float nextAlpha(float learningRate);
+	void calc_pix_impl(float pix, uchar* dst,
 		MixtureData mptr[], float alpha);
-	void calc_impl(uchar* frame, uchar* mask,
-		MixtureData* mptr, float alpha);
+	void allocateModel(int npixels);
+	// Runs band(i) for every i in [0, numBands), band 0 on the calling
+	// thread and the others on pool threads
+	void runBands(int numBands, const std::function<void(int)>& band);
+	void startPool(int numWorkers);
+	void stopPool();
+	void poolThread(int band, unsigned generation);
+	template<typename T>
+	void calc_impl(const cv::Mat& frame, cv::Mat& mask,
+		int firstRow, int endRow, float alpha,
+		const RowProducer& produceRows);
 
 private:
 	const int rows;
@@ -55,11 +115,33 @@ private:
 	const int history;
 
 	int nframe;
+	int numThreads;
+	int pixelDepth;
+	// Variances are expressed in squared pixel units,
+	// scale defaults tuned for 8 bits to actual pixel range
+	float varianceScale;
 
 	float backgroundRatio;
 	float varThreshold;
-	float noiseSigma;
 	float initialWeight;
+	float initialVariance;
+	float minVariance;
 
 	cv::Mat bgmodel;
+	const RegionOfInterest* roi;
+
+	// Threads of setNumThreads(n), thread i always takes band i + 1
+	std::vector<std::thread> pool;
+	std::mutex poolMutex;
+	std::condition_variable poolWake;
+	std::condition_variable poolDone;
+	const std::function<void(int)>* poolJob;
+	int poolBands;
+	int poolPending;         // bands of current job not finished yet
+	unsigned poolGeneration; // incremented with every job
+	bool poolStop;
+
+private:
+	MixtureOfGaussianCPU(const MixtureOfGaussianCPU&);
+	MixtureOfGaussianCPU& operator=(const MixtureOfGaussianCPU&);
 };
\ No newline at end of file
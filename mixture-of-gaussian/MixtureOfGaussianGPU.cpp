@@ -1,4 +1,6 @@
 #include "MixtureOfGaussianGPU.h"
+#include "WorkGroupTuner.h"
+#include "RegionOfInterest.h"
 
 #include <opencv2/core/core.hpp>
 #include <iostream>
@@ -10,6 +12,10 @@ MixtureOfGaussianGPU::MixtureOfGaussianGPU(const clw::Context& context,
 	: context(context)
 	, device(device)
 	, queue(queue)
+	, width(0)
+	, height(0)
+	, nmixtures(0)
+	, pixelDepth(8)
 	, nframe(0)
 	, history(200)
 	, varianceThreshold(6.25f)
@@ -17,6 +23,9 @@ MixtureOfGaussianGPU::MixtureOfGaussianGPU(const clw::Context& context,
 	, initialWeight(0.05f)
 	, initialVariance(500)
 	, minVariance(0.4f)
+	, varianceScale(1.0f)
+	, roi(nullptr)
+	, hostUpdateRule(false)
 {
 }
 
@@ -36,28 +45,60 @@ void MixtureOfGaussianGPU::setMixtureParameters(int history,
 
 	createMixtureParamsBuffer();
 }
+
+void MixtureOfGaussianGPU::setRegionOfInterest(const RegionOfInterest* roi)
+{
+	this->roi = roi && !roi->isFullFrame() ? roi : nullptr;
+}
 	
 void MixtureOfGaussianGPU::init(int imageWidth,
                                 int imageHeight, 
                                 int workGroupSizeX,
                                 int workGroupSizeY,
-                                int nmixtures)
+                                int nmixtures,
+                                int pixelDepth)
 {
-	nframe = 0;
-	createMoGKernel(nmixtures);
-	createMixtureDataBuffer(imageWidth * imageHeight, nmixtures);
-	createMixtureParamsBuffer();
-	createOutputImage(imageWidth, imageHeight);
+	pixelDepth = std::min(std::max(pixelDepth, 8), 16);
+
+	// InitialVariance and MinVariance are given for 8 bits pixel range
+	const float rangeScale = float((1 << pixelDepth) - 1) / 255.0f;
+	varianceScale = rangeScale * rangeScale;
 
 	width = imageWidth;
 	height = imageHeight;
+	this->nmixtures = nmixtures;
+	this->pixelDepth = pixelDepth;
+
+	nframe = 0;
+	createMoGKernel(nmixtures, pixelDepth);
+	createMixtureDataBuffer(modelOffset(height), nmixtures);
+	createMixtureParamsBuffer();
+	createOutputImage(imageWidth, imageHeight);
 
-	kernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
-	kernel.setRoundedGlobalWorkSize(imageWidth, imageHeight);
 	kernel.setArg(1, outputImage);
 	kernel.setArg(2, mixtureDataBuffer);
 	kernel.setArg(3, mixtureParamsBuffer);
 	kernel.setArg(4, 0.0f);
+
+	if(roi)
+	{
+		// Indices of modelled pixels, model is compacted to them
+		std::vector<int> indices = roi->pixelIndices();
+		if(indices.empty())
+			indices.push_back(0);
+		roiIndicesBuffer = context.createBuffer(
+			clw::Access_ReadOnly, clw::Location_Device,
+			indices.size() * sizeof(int), indices.data());
+		kernel.setArg(5, roiIndicesBuffer);
+		kernel.setArg(7, roi->numPixels());
+
+		// Pixels outside region of interest are never written
+		std::vector<cl_uchar> zeros(size_t(width) * height, 0);
+		queue.asyncWriteImage2D(outputImage, zeros.data(), 0, 0, width, height);
+		queue.finish();
+	}
+
+	setKernelWorkGroupSize(workGroupSizeX, workGroupSizeY);
 }
 
 void MixtureOfGaussianGPU::setKernelWorkGroupSize(int workGroupSizeX,
@@ -65,13 +106,70 @@ void MixtureOfGaussianGPU::setKernelWorkGroupSize(int workGroupSizeX,
 {
 	if(!kernel.isNull())
 	{
-		kernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
-		kernel.setRoundedGlobalWorkSize(width, height);
+		// ROI kernel is 1D, it takes the same number of work-items
+		if(roi)
+			kernel.setLocalWorkSize(workGroupSizeX * workGroupSizeY, 1);
+		else
+			kernel.setLocalWorkSize(workGroupSizeX, workGroupSizeY);
+		setGlobalWorkSize(height);
+	}
+}
+
+void MixtureOfGaussianGPU::setGlobalWorkSize(int numRows)
+{
+	if(roi)
+	{
+		const int count = modelOffset(numRows);
+		kernel.setRoundedGlobalWorkSize(std::max(count, 1), 1);
+		kernel.setArg(6, count);
+	}
+	else
+	{
+		kernel.setRoundedGlobalWorkSize(width, numRows);
 	}
 }
 
+int MixtureOfGaussianGPU::modelOffset(int y) const
+{
+	return roi ? roi->rowOffset(y) : y * width;
+}
+
+void MixtureOfGaussianGPU::tuneWorkGroupSize(WorkGroupTuner& tuner,
+                                             clw::Image2D& sampleFrame,
+                                             int* workGroupSizeX,
+                                             int* workGroupSizeY)
+{
+	std::ostringstream kernelKey;
+	// ROI kernel runs over modelled pixels only, its cost depends on their number
+	if(roi)
+		kernelKey << "mog_roi/" << roi->numPixels() << " pixels/";
+	else
+		kernelKey << "mog_image/";
+	kernelKey << nmixtures << " mixtures/" << pixelDepth << " bits";
+
+	// Same global sizes as setGlobalWorkSize() for the whole frame
+	const int globalWidth = roi ? std::max(roi->numPixels(), 1) : width;
+	const int globalHeight = roi ? 1 : height;
+	tuner.tune(device, kernel, kernelKey.str(), globalWidth, globalHeight, queue,
+		[this](int x, int y) { setKernelWorkGroupSize(x, y); },
+		[&] { return process(sampleFrame); },
+		workGroupSizeX, workGroupSizeY, roi != nullptr);
+
+	// Tuning runs have updated the model with the sample
+	resetModel();
+}
+
+void MixtureOfGaussianGPU::resetModel()
+{
+	void* ptr = queue.mapBuffer(mixtureDataBuffer, clw::MapAccess_Write);
+	memset(ptr, 0, mixtureDataBuffer.size());
+	queue.unmap(mixtureDataBuffer, ptr);
+	nframe = 0;
+}
+
 clw::Event MixtureOfGaussianGPU::process(clw::Image2D& inputGrayFrame,
-                                         float learningRate)
+                                         float learningRate,
+                                         int numRows)
 {
 	if(kernel.isNull())
 		return clw::Event();
@@ -85,15 +183,86 @@ clw::Event MixtureOfGaussianGPU::process(clw::Image2D& inputGrayFrame,
 	kernel.setArg(0, inputGrayFrame);
 	kernel.setArg(4, alpha);
 
+	// Rows past numRows (up to work-group boundary) are computed too,
+	// their model is then stale but it's not used
+	setGlobalWorkSize(numRows >= 0 ? std::min(numRows, height) : height);
+
 	cv::Mat dst(height, width, CV_8UC1);
 
 	return queue.asyncRunKernel(kernel);
 }
 
-void MixtureOfGaussianGPU::createMoGKernel(int nmixtures)
+void MixtureOfGaussianGPU::downloadModel(std::vector<float>* mixtureData,
+                                         int* frameCount)
 {
+	downloadModelRows(0, height, mixtureData);
+	*frameCount = nframe;
+}
+
+bool MixtureOfGaussianGPU::uploadModel(const std::vector<float>& mixtureData,
+                                       int frameCount)
+{
+	if(!uploadModelRows(0, height, mixtureData))
+		return false;
+	nframe = frameCount;
+	return true;
+}
+
+void MixtureOfGaussianGPU::downloadModelRows(int firstRow,
+                                             int numRows,
+                                             std::vector<float>* mixtureData)
+{
+	const size_t planeSize = modelOffset(height);
+	const size_t rowsOffset = modelOffset(firstRow);
+	const size_t rowsSize = modelOffset(firstRow + numRows) - rowsOffset;
+	const int nplanes = nmixtures * 3;
+	mixtureData->resize(rowsSize * nplanes);
+
+	const float* ptr = static_cast<const float*>(
+		queue.mapBuffer(mixtureDataBuffer, clw::MapAccess_Read));
+	for(int plane = 0; plane < nplanes; ++plane)
+	{
+		memcpy(mixtureData->data() + plane * rowsSize,
+			ptr + plane * planeSize + rowsOffset,
+			rowsSize * sizeof(float));
+	}
+	queue.unmap(mixtureDataBuffer, const_cast<float*>(ptr));
+}
+
+bool MixtureOfGaussianGPU::uploadModelRows(int firstRow,
+                                           int numRows,
+                                           const std::vector<float>& mixtureData)
+{
+	if(firstRow < 0 || numRows < 0 || firstRow + numRows > height)
+		return false;
+	const size_t planeSize = modelOffset(height);
+	const size_t rowsOffset = modelOffset(firstRow);
+	const size_t rowsSize = modelOffset(firstRow + numRows) - rowsOffset;
+	const int nplanes = nmixtures * 3;
+	if(mixtureData.size() != rowsSize * nplanes)
+		return false;
+
+	// Whole buffer is mapped for reading too, other rows must survive
+	float* ptr = static_cast<float*>(
+		queue.mapBuffer(mixtureDataBuffer, clw::MapAccess_ReadWrite));
+	for(int plane = 0; plane < nplanes; ++plane)
+	{
+		memcpy(ptr + plane * planeSize + rowsOffset,
+			mixtureData.data() + plane * rowsSize,
+			rowsSize * sizeof(float));
+	}
+	queue.unmap(mixtureDataBuffer, ptr);
+	return true;
+}
+
+void MixtureOfGaussianGPU::createMoGKernel(int nmixtures, int pixelDepth)
+{
+	// Normalized input is scaled back to its integer range
 	std::ostringstream ss;
 	ss << "-Dnmixtures=" << nmixtures;
+	ss << " -DPIXEL_SCALE=" << (pixelDepth > 8 ? "65535.0f" : "255.0f");
+	if(hostUpdateRule)
+		ss << " -DHOST_UPDATE_RULE";
 	std::string buildOptions = ss.str();
 
 	clw::Program progMog = context.createProgramFromSourceFile("mixture-of-gaussian.cl");
@@ -103,22 +272,20 @@ void MixtureOfGaussianGPU::createMoGKernel(int nmixtures)
 		std::exit(-1);
 	}
 	std::cout << progMog.log();
-	kernel = progMog.createKernel("mog_image");
+	kernel = progMog.createKernel(roi ? "mog_roi" : "mog_image");
 }
 
 void MixtureOfGaussianGPU::createMixtureDataBuffer(int npixels, 
                                                    int nmixtures)
 {
 	// Dane mikstur (stan wewnetrzny estymatora tla)
-	const int mixtureDataSize = nmixtures * npixels * 3 * sizeof(float);
+	const int mixtureDataSize = nmixtures * std::max(npixels, 1) * 3 * sizeof(float);
 
 	mixtureDataBuffer = context.createBuffer
 		(clw::Access_ReadWrite, clw::Location_Device, mixtureDataSize);
 
 	// Wyzerowane
-	void* ptr = queue.mapBuffer(mixtureDataBuffer, clw::MapAccess_Write);
-	memset(ptr, 0, mixtureDataSize);
-	queue.unmap(mixtureDataBuffer, ptr);
+	resetModel();
 }
 
 void MixtureOfGaussianGPU::createMixtureParamsBuffer()
@@ -137,8 +304,8 @@ void MixtureOfGaussianGPU::createMixtureParamsBuffer()
 		varianceThreshold,
 		backgroundRatio,
 		initialWeight,
-		initialVariance,
-		minVariance
+		initialVariance * varianceScale,
+		minVariance * varianceScale
 	};
 
 	mixtureParamsBuffer = context.createBuffer(
@@ -149,9 +316,10 @@ void MixtureOfGaussianGPU::createMixtureParamsBuffer()
 void MixtureOfGaussianGPU::createOutputImage(int width,
                                              int height)
 {
-	// Obraz (w zasadzie maska) pierwszego planu
+	// Obraz (w zasadzie maska) pierwszego planu,
+	// czytany jeszcze przez upscale_binned_mask
 	outputImage = context.createImage2D
-		(clw::Access_WriteOnly, clw::Location_Device,
+		(clw::Access_ReadWrite, clw::Location_Device,
 		 clw::ImageFormat(clw::Order_R, clw::Type_Normalized_UInt8),
 		 width, height);
 }
\ No newline at end of file
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <clw/clw.h>
+#include <vector>
+
+class WorkGroupTuner;
+class RegionOfInterest;
 
 class MixtureOfGaussianGPU
 {
@@ -16,16 +20,54 @@ public:
 		float initialVariance,
 		float minVariance);
 
+	// Models only pixels of roi (must outlive the engine), the rest of output
+	// is background. Call before init(), nullptr - whole frame
+	void setRegionOfInterest(const RegionOfInterest* roi);
+
+	// Updates mean and variance with alpha like MixtureOfGaussianCPU instead
+	// of rho = alpha * N(pix | mean, var), for sharing frames and model with
+	// it (hybrid worker). Call before init()
+	void setHostUpdateRule(bool enabled) { hostUpdateRule = enabled; }
+
+	// pixelDepth - number of significant bits of input pixels, 
+	// more than 8 requires input image of Type_Normalized_UInt16
 	void init(int imageWidth, int imageHeight, 
-		int workGroupSizeX, int workGroupSizeY, int nmixtures = 5);
+		int workGroupSizeX, int workGroupSizeY, int nmixtures = 5,
+		int pixelDepth = 8);
 
 	void setKernelWorkGroupSize(int workGroupSizeX, int workGroupSizeY);
 
-	clw::Event process(clw::Image2D& inputGrayFrame, float learningRate = -1);
+	// Finds best local size running the kernel on sampleFrame (on first use
+	// per device and frame size), model is reset afterwards. 
+	// workGroupSizeX/Y - in: default size, out: size being used
+	void tuneWorkGroupSize(WorkGroupTuner& tuner, clw::Image2D& sampleFrame,
+		int* workGroupSizeX, int* workGroupSizeY);
+
+	// Forgets the background (blocking)
+	void resetModel();
+
+	// numRows - process only first rows of the frame (-1 - whole frame)
+	clw::Event process(clw::Image2D& inputGrayFrame, float learningRate = -1,
+		int numRows = -1);
 	clw::Image2D output() const { return outputImage; }
 
+	// Background model state, used to move the model to another device
+	// (blocking, queue must not have pending work for this model)
+	void downloadModel(std::vector<float>* mixtureData, int* frameCount);
+	bool uploadModel(const std::vector<float>& mixtureData, int frameCount);
+
+	// Part of the model for rows [firstRow, firstRow + numRows), layout is
+	// the same as on device: 3 * nmixtures planes (weights, means, variances)
+	// of numRows * width values each
+	void downloadModelRows(int firstRow, int numRows, std::vector<float>* mixtureData);
+	bool uploadModelRows(int firstRow, int numRows, const std::vector<float>& mixtureData);
+	int numMixtures() const { return nmixtures; }
+
 private:
-	void createMoGKernel(int nmixtures);
+	void createMoGKernel(int nmixtures, int pixelDepth);
+	void setGlobalWorkSize(int numRows);
+	// Index of the first pixel of row y in the model
+	int modelOffset(int y) const;
 	void createMixtureDataBuffer(int npixels, int nmixtures);
 	void createMixtureParamsBuffer();
 	void createOutputImage(int width, int height);
@@ -37,9 +79,12 @@ private:
 	clw::Kernel kernel;
 	clw::Buffer mixtureDataBuffer;
 	clw::Buffer mixtureParamsBuffer;
+	clw::Buffer roiIndicesBuffer;
 	clw::Image2D outputImage;
 
 	int width, height;
+	int nmixtures;
+	int pixelDepth;
 	int nframe;
 	int history;
 	float varianceThreshold;
@@ -47,6 +92,9 @@ private:
 	float initialWeight;
 	float initialVariance;
 	float minVariance;
+	float varianceScale;
+	const RegionOfInterest* roi;
+	bool hostUpdateRule;
 
 private:
 	MixtureOfGaussianGPU(const MixtureOfGaussianGPU&);
@@ -0,0 +1,41 @@
+#include "MonotonicClock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#undef max
+#undef min
+
+namespace
+{
+	int64_t queryFrequency()
+	{
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency(&freq);
+		return freq.QuadPart;
+	}
+}
+
+int64_t MonotonicClock::nanoseconds()
+{
+	static const int64_t frequency = queryFrequency();
+
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	// Split to avoid overflow of counter * 1e9
+	const int64_t seconds = counter.QuadPart / frequency;
+	const int64_t remainder = counter.QuadPart % frequency;
+	return seconds * 1000000000 + remainder * 1000000000 / frequency;
+}
+
+#else
+#include <time.h>
+
+int64_t MonotonicClock::nanoseconds()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+//
+// Monotonic high resolution clock: CLOCK_MONOTONIC on POSIX, 
+// QueryPerformanceCounter on Windows (invariant TSC based, the same on
+// every core - no need to pin threads). Unaffected by wall clock changes.
+// Usable wherever a std::chrono clock is expected.
+//
+
+class MonotonicClock
+{
+public:
+	typedef std::chrono::nanoseconds duration;
+	typedef duration::rep rep;
+	typedef duration::period period;
+	typedef std::chrono::time_point<MonotonicClock> time_point;
+	static const bool is_steady = true;
+
+	static time_point now() { return time_point(duration(nanoseconds())); }
+
+	// Time since arbitrary epoch
+	static int64_t nanoseconds();
+	static double seconds() { return nanoseconds() * 1e-9; }
+};
@@ -0,0 +1,167 @@
+#include "RegionOfInterest.h"
+#include "ConfigFile.h"
+
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <iostream>
+#include <sstream>
+
+namespace
+{
+	// "x,y,w,h; x,y,w,h; ..."
+	bool parseRects(const std::string& value, std::vector<cv::Rect>* rects)
+	{
+		std::istringstream list(value);
+		std::string item;
+		while(std::getline(list, item, ';'))
+		{
+			if(item.find_first_not_of(" \t") == std::string::npos)
+				continue;
+
+			std::istringstream strm(item);
+			cv::Rect rect;
+			char comma[3];
+			strm >> rect.x >> comma[0] >> rect.y >> comma[1]
+				>> rect.width >> comma[2] >> rect.height;
+			if(strm.fail() || comma[0] != ',' || comma[1] != ',' || comma[2] != ','
+				|| rect.width <= 0 || rect.height <= 0)
+				return false;
+			rects->push_back(rect);
+		}
+		return true;
+	}
+}
+
+RegionOfInterest::RegionOfInterest()
+	: fullFrame(true)
+	, cols(0)
+	, rows(0)
+{
+}
+
+bool RegionOfInterest::init(const StreamConfig& cfg, int frameWidth, int frameHeight,
+                            int width, int height)
+{
+	cols = width;
+	rows = height;
+	spans.clear();
+	rowSpanBegin.clear();
+	rowOffsets.clear();
+	indices.clear();
+
+	cv::Mat mask;
+	if(!buildMask(cfg, frameWidth, frameHeight, mask))
+		return false;
+
+	fullFrame = mask.empty();
+	if(fullFrame)
+	{
+		// Engines still use row offsets (rows are whole)
+		rowOffsets.resize(rows + 1);
+		for(int y = 0; y <= rows; ++y)
+			rowOffsets[y] = y * cols;
+		return true;
+	}
+
+	// Binned Bayer: model is smaller than the frame
+	if(mask.cols != width || mask.rows != height)
+	{
+		cv::Mat scaled;
+		cv::resize(mask, scaled, cv::Size(width, height), 0, 0, cv::INTER_NEAREST);
+		mask = scaled;
+	}
+
+	buildSpans(mask);
+	std::cout << "  region of interest: " << numPixels() << " of "
+		<< cols * rows << " pixels modelled\n";
+	return true;
+}
+
+bool RegionOfInterest::buildMask(const StreamConfig& cfg, int frameWidth, int frameHeight,
+                                 cv::Mat& mask)
+{
+	const std::string maskFile = cfg.value("RoiMask", "General");
+	const std::string rectsCfg = cfg.value("RoiRects", "General");
+	const std::string excludeCfg = cfg.value("RoiExclude", "General");
+
+	std::vector<cv::Rect> rects, excluded;
+	if(!parseRects(rectsCfg, &rects) || !parseRects(excludeCfg, &excluded))
+	{
+		std::cerr << "Parameter RoiRects or RoiExclude is wrong, must be list of "
+			"x,y,width,height separated by ';'\n";
+		return false;
+	}
+
+	if(maskFile.empty() && rects.empty() && excluded.empty())
+		return true;
+
+	const cv::Rect frameRect(0, 0, frameWidth, frameHeight);
+
+	if(!maskFile.empty())
+	{
+		mask = cv::imread(maskFile, CV_LOAD_IMAGE_GRAYSCALE);
+		if(mask.empty())
+		{
+			std::cerr << "Can't load region of interest mask " << maskFile << "\n";
+			return false;
+		}
+		if(mask.cols != frameWidth || mask.rows != frameHeight)
+		{
+			std::cerr << "Region of interest mask " << maskFile << " must have size of the frame ("
+				<< frameWidth << "x" << frameHeight << ")\n";
+			return false;
+		}
+		cv::compare(mask, 0, mask, cv::CMP_GT);
+	}
+	else
+	{
+		// Only excluded areas given - everything else is modelled
+		mask = cv::Mat(frameHeight, frameWidth, CV_8UC1,
+			cv::Scalar::all(rects.empty() ? 255 : 0));
+	}
+
+	// Rectangles add to the mask (if there's one)
+	for(auto& rect : rects)
+		mask(rect & frameRect) = cv::Scalar::all(255);
+	for(auto& rect : excluded)
+		mask(rect & frameRect) = cv::Scalar::all(0);
+
+	return true;
+}
+
+void RegionOfInterest::buildSpans(const cv::Mat& mask)
+{
+	rowSpanBegin.resize(rows + 1);
+	rowOffsets.resize(rows + 1);
+
+	int offset = 0;
+	for(int y = 0; y < rows; ++y)
+	{
+		rowSpanBegin[y] = int(spans.size());
+		rowOffsets[y] = offset;
+
+		const uchar* src = mask.ptr<uchar>(y);
+		for(int x = 0; x < cols; )
+		{
+			if(!src[x])
+			{
+				++x;
+				continue;
+			}
+
+			Span span;
+			span.x0 = x;
+			while(x < cols && src[x])
+				++x;
+			span.x1 = x;
+			spans.push_back(span);
+
+			for(int i = span.x0; i < span.x1; ++i)
+				indices.push_back(y * cols + i);
+			offset += span.x1 - span.x0;
+		}
+	}
+
+	rowSpanBegin[rows] = int(spans.size());
+	rowOffsets[rows] = offset;
+}
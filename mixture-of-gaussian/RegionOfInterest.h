@@ -0,0 +1,64 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+class StreamConfig;
+
+//
+// Pixels of a stream that are modelled at all, given in config as rectangles
+// and/or a mask image, minus excluded rectangles (sky, timestamp overlays).
+// Pixels outside are background and keep no model. Modelled pixels are
+// numbered row by row (compacted index), so any range of rows maps to
+// a contiguous range of them - engines store their mixtures in that order.
+//
+
+class RegionOfInterest
+{
+public:
+	// Horizontal run of modelled pixels [x0, x1) in a row
+	struct Span
+	{
+		int x0;
+		int x1;
+	};
+
+	RegionOfInterest();
+
+	// Reads RoiRects, RoiMask and RoiExclude of the stream. Coordinates are
+	// in the source frame (frameWidth x frameHeight) and are scaled when
+	// the model is smaller (width x height, binned Bayer).
+	bool init(const StreamConfig& cfg, int frameWidth, int frameHeight,
+		int width, int height);
+
+	// Nothing configured, every pixel is modelled
+	bool isFullFrame() const { return fullFrame; }
+	int width() const { return cols; }
+	int height() const { return rows; }
+
+	// Compacted index of the first modelled pixel of row y,
+	// rowOffset(height()) is the number of modelled pixels
+	int rowOffset(int y) const { return rowOffsets[y]; }
+	int numPixels() const { return rowOffsets[rows]; }
+
+	// Spans of row y, sorted by x
+	const Span* rowSpans(int y) const { return spans.data() + rowSpanBegin[y]; }
+	int numRowSpans(int y) const { return rowSpanBegin[y + 1] - rowSpanBegin[y]; }
+
+	// Frame index (y * width + x) of every modelled pixel in compacted order
+	// (empty for full frame)
+	const std::vector<int>& pixelIndices() const { return indices; }
+
+private:
+	bool buildMask(const StreamConfig& cfg, int frameWidth, int frameHeight, cv::Mat& mask);
+	void buildSpans(const cv::Mat& mask);
+
+private:
+	bool fullFrame;
+	int cols;
+	int rows;
+	std::vector<Span> spans;
+	std::vector<int> rowSpanBegin;
+	std::vector<int> rowOffsets;
+	std::vector<int> indices;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+//
+// Bounded, lock-free queue for exactly one producer thread
+// and exactly one consumer thread (e.g. Sapera transfer callback -> worker)
+//
+
+template<typename T>
+class SpscQueue
+{
+public:
+	explicit SpscQueue(size_t capacity)
+		: items(capacity + 1)
+		, head(0)
+		, tail(0)
+	{
+	}
+
+	// Called only by the producer. Returns false if queue is full.
+	bool push(const T& item)
+	{
+		const size_t t = tail.load(std::memory_order_relaxed);
+		const size_t next = increment(t);
+		if(next == head.load(std::memory_order_acquire))
+			return false;
+
+		items[t] = item;
+		tail.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Called only by the consumer. Returns false if queue is empty.
+	bool pop(T* item)
+	{
+		const size_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load(std::memory_order_acquire))
+			return false;
+
+		*item = items[h];
+		head.store(increment(h), std::memory_order_release);
+		return true;
+	}
+
+	bool empty() const
+	{
+		return head.load(std::memory_order_acquire) ==
+			tail.load(std::memory_order_acquire);
+	}
+
+	size_t capacity() const { return items.size() - 1; }
+
+private:
+	size_t increment(size_t idx) const
+	{
+		return (idx + 1) == items.size() ? 0 : idx + 1;
+	}
+
+private:
+	std::vector<T> items;
+	std::atomic<size_t> head;
+	std::atomic<size_t> tail;
+
+private:
+	SpscQueue(const SpscQueue&);
+	SpscQueue& operator=(const SpscQueue&);
+};
@@ -0,0 +1,90 @@
+#include "StageProfiler.h"
+
+#include <iostream>
+
+namespace
+{
+	const char* stageNames[Stage_Count] = {
+		"upload", "preprocess", "MoG", "readback"
+	};
+
+	void printHistogram(std::ostream& strm, const char* name, const LatencyHistogram& hist)
+	{
+		if(hist.count() == 0)
+			return;
+		strm << "  " << name << ": mean " << hist.mean() * 1e-6
+			<< " ms, p50 " << hist.percentile(0.50) * 1e-6
+			<< " ms, p99 " << hist.percentile(0.99) * 1e-6
+			<< " ms, p999 " << hist.percentile(0.999) * 1e-6
+			<< " ms, max " << hist.max() * 1e-6 << " ms (" << hist.count() << " commands)\n";
+	}
+}
+
+const char* stageName(EStage stage)
+{
+	return stageNames[stage];
+}
+
+StageProfiler::StageProfiler()
+{
+}
+
+void StageProfiler::add(EStage stage, const clw::Event& event)
+{
+	if(!event.isNull())
+		pending.push_back(std::make_pair(stage, event));
+}
+
+void StageProfiler::frameFinished()
+{
+	frameTimings.clear();
+
+	for(auto& command : pending)
+	{
+		const clw::Event& event = command.second;
+
+		CommandTiming timing;
+		timing.stage = command.first;
+		timing.queued = event.queuedTime();
+		timing.submitted = event.submittedTime();
+		timing.started = event.startTime();
+		timing.finished = event.finishTime();
+		frameTimings.push_back(timing);
+
+		stageTime[timing.stage].record(timing.finished - timing.started);
+		queueLatency.record(timing.started - timing.queued);
+	}
+
+	pending.clear();
+}
+
+double StageProfiler::lastStageTime(EStage stage) const
+{
+	uint64_t time = 0;
+	for(auto& timing : frameTimings)
+	{
+		if(timing.stage == stage)
+			time += timing.finished - timing.started;
+	}
+	return time * 1e-6;
+}
+
+double StageProfiler::lastDeviceTime() const
+{
+	uint64_t time = 0;
+	for(auto& timing : frameTimings)
+		time += timing.finished - timing.started;
+	return time * 1e-6;
+}
+
+void StageProfiler::report(std::ostream& strm, const std::string& title)
+{
+	strm << title << " device stages:\n";
+	for(int stage = 0; stage < Stage_Count; ++stage)
+	{
+		printHistogram(strm, stageNames[stage], stageTime[stage]);
+		stageTime[stage].reset();
+	}
+	printHistogram(strm, "queue latency", queueLatency);
+	queueLatency.reset();
+}
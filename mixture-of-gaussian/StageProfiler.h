@@ -0,0 +1,65 @@
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <clw/clw.h>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum EStage
+{
+	Stage_Upload,
+	Stage_Preprocess,
+	Stage_MoG,
+	Stage_Readback,
+	Stage_Count
+};
+
+const char* stageName(EStage stage);
+
+//
+// Collects profiling info of every OpenCL command a stream enqueues
+// (queue must have profiling enabled). Commands of a frame are added
+// as they're enqueued and read once the queue is finished.
+//
+
+class StageProfiler
+{
+public:
+	// Timestamps of one command [ns, device clock]
+	struct CommandTiming
+	{
+		EStage stage;
+		uint64_t queued;
+		uint64_t submitted;
+		uint64_t started;
+		uint64_t finished;
+	};
+
+	StageProfiler();
+
+	void add(EStage stage, const clw::Event& event);
+	// Reads timestamps of commands added since last call (blocking)
+	void frameFinished();
+
+	// Commands of the last finished frame
+	const std::vector<CommandTiming>& lastFrame() const { return frameTimings; }
+	// Execution time of stage / all stages in the last frame [ms]
+	double lastStageTime(EStage stage) const;
+	double lastDeviceTime() const;
+
+	// Prints per-stage and queue latency histograms gathered
+	// since the previous report and starts over
+	void report(std::ostream& strm, const std::string& title);
+
+private:
+	std::vector<std::pair<EStage, clw::Event>> pending;
+	std::vector<CommandTiming> frameTimings;
+
+	LatencyHistogram stageTime[Stage_Count];
+	// Time command waits in driver queue (queued -> start)
+	LatencyHistogram queueLatency;
+};
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "ConfigFile.h"
+#include "MonotonicClock.h"
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+//
+// Keeps track of all video streams and their workers. Streams are listed
+// in [General] as VideoStream<N> = source (any number of them), each one
+// may override MoG and work-group parameters in its own [VideoStream<N>]
+// section. Calling sync() after reloading configuration starts new streams
+// and drops removed ones, leaving all other streams (and their models) intact.
+//
+
+template<typename Worker>
+class StreamRegistry
+{
+public:
+	typedef std::function<Worker*(const StreamConfig&)> WorkerFactory;
+
+	struct Stream
+	{
+		std::string id;     // config key, e.g. VideoStream7
+		std::string source; // file, device or camera configuration
+		const char* traceName; // source interned for trace spans
+		std::unique_ptr<Worker> worker;
+		bool grabbed;       // was last grab successful
+		int frameNumber;    // frames processed so far
+	};
+
+	StreamRegistry(ConfigFile& cfg, const WorkerFactory& createWorker)
+		: cfg(cfg)
+		, createWorker(createWorker)
+	{
+	}
+
+	// Brings running streams in line with configuration.
+	// Returns sources of streams that were removed.
+	std::vector<std::string> sync()
+	{
+		std::vector<std::pair<std::string, std::string>> configured = configuredStreams();
+		std::vector<std::string> removed;
+
+		// Drop streams that are gone or whose source has changed
+		for(auto it = running.begin(); it != running.end(); )
+		{
+			auto found = std::find(configured.begin(), configured.end(),
+				std::make_pair((*it)->id, (*it)->source));
+
+			if(found == configured.end())
+			{
+				std::cout << "Removing stream " << (*it)->id << " (" << (*it)->source << ")\n";
+				removed.push_back((*it)->source);
+				it = running.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+
+		// Forget failures of streams no longer configured (so fixed entries are retried)
+		for(auto it = failed.begin(); it != failed.end(); )
+		{
+			if(std::find(configured.begin(), configured.end(), *it) == configured.end())
+				it = failed.erase(it);
+			else
+				++it;
+		}
+
+		// Start the new ones
+		std::vector<std::unique_ptr<Stream>> pending;
+		for(auto& entry : configured)
+		{
+			if(find(entry.first) == nullptr &&
+				std::find(failed.begin(), failed.end(), entry) == failed.end())
+			{
+				std::unique_ptr<Stream> stream(new Stream);
+				stream->id = entry.first;
+				stream->source = entry.second;
+				stream->traceName = TraceRecorder::intern(entry.second);
+				stream->grabbed = false;
+				stream->frameNumber = 0;
+				pending.push_back(std::move(stream));
+			}
+		}
+
+		if(!pending.empty())
+			startStreams(pending);
+
+		return removed;
+	}
+
+	size_t size() const { return running.size(); }
+	bool empty() const { return running.empty(); }
+	Stream& operator[](size_t index) { return *running[index]; }
+
+private:
+	Stream* find(const std::string& id)
+	{
+		for(auto& stream : running)
+		{
+			if(stream->id == id)
+				return stream.get();
+		}
+		return nullptr;
+	}
+
+	// VideoStream<N> keys sorted by N
+	std::vector<std::pair<std::string, std::string>> configuredStreams()
+	{
+		static const std::string prefix = "VideoStream";
+		std::vector<std::pair<int, std::pair<std::string, std::string>>> streams;
+
+		std::vector<std::string> keys = cfg.keys("General");
+		for(auto& key : keys)
+		{
+			if(key.compare(0, prefix.length(), prefix) != 0 || key.length() == prefix.length())
+				continue;
+
+			std::string number = key.substr(prefix.length());
+			if(number.find_first_not_of("0123456789") != std::string::npos)
+				continue;
+
+			std::string source = cfg.value(key, "General");
+			if(!source.empty())
+				streams.push_back(std::make_pair(std::atoi(number.c_str()), std::make_pair(key, source)));
+		}
+
+		std::sort(streams.begin(), streams.end());
+
+		std::vector<std::pair<std::string, std::string>> result;
+		for(auto& stream : streams)
+			result.push_back(stream.second);
+		return result;
+	}
+
+	// Creates and initializes workers for all streams concurrently (grabber
+	// opening, format probing, kernel building), so startup takes as long as
+	// the slowest stream, not the sum of all. Streams that fail are dropped.
+	void startStreams(std::vector<std::unique_ptr<Stream>>& pending)
+	{
+		typedef MonotonicClock clock;
+
+		const size_t numStreams = pending.size();
+		std::vector<char> succeeded(numStreams, 0);
+		std::vector<double> startupTime(numStreams, 0.0);
+		std::atomic<size_t> nextStream(0);
+
+		auto initTask = [&]
+		{
+			for(size_t i = nextStream++; i < numStreams; i = nextStream++)
+			{
+				auto start = clock::now();
+				try
+				{
+					StreamConfig streamCfg(cfg, pending[i]->id);
+					pending[i]->worker = std::unique_ptr<Worker>(createWorker(streamCfg));
+					succeeded[i] = pending[i]->worker->init(pending[i]->source);
+				}
+				catch(std::exception& ex)
+				{
+					std::cerr << "Error initializing " << pending[i]->source
+						<< ": " << ex.what() << "\n";
+				}
+				startupTime[i] = std::chrono::duration<double, std::milli>
+					(clock::now() - start).count();
+			}
+		};
+
+		size_t numThreads = std::max(1u, std::thread::hardware_concurrency());
+		numThreads = std::min(numThreads, numStreams);
+
+		std::vector<std::thread> pool;
+		for(size_t t = 1; t < numThreads; ++t)
+			pool.emplace_back(initTask);
+		initTask();
+		for(auto& thread : pool)
+			thread.join();
+
+		std::cout << "\nStartup time per stream:\n";
+		for(size_t i = 0; i < numStreams; ++i)
+		{
+			std::cout << "  " << pending[i]->source << ": " << startupTime[i] << " ms"
+				<< (succeeded[i] ? "\n" : " (failed, skipping)\n");
+
+			if(succeeded[i])
+				running.push_back(std::move(pending[i]));
+			else
+				failed.push_back(std::make_pair(pending[i]->id, pending[i]->source));
+		}
+	}
+
+private:
+	ConfigFile& cfg;
+	WorkerFactory createWorker;
+	std::vector<std::unique_ptr<Stream>> running;
+	std::vector<std::pair<std::string, std::string>> failed;
+
+private:
+	StreamRegistry(const StreamRegistry&);
+	StreamRegistry& operator=(const StreamRegistry&);
+};
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "LatestValue.h"
+#include "FrameGovernor.h"
+#include "TraceRecorder.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+//
+// Runs worker's grab -> process loop on its own thread and publishes
+// finished masks to a latest-value slot, so a slow stream doesn't stall
+// the others and display/consumers never block processing
+//
+
+template<typename Worker>
+class ThreadedWorker
+{
+public:
+	struct Output
+	{
+		cv::Mat finalFrame;
+		cv::Mat sourceFrame;       // only if requested
+		cv::Mat intermediateFrame; // only if requested
+		double processingTime;     // [ms]
+		int frameNumber;
+	};
+
+	// governor - paces the stream and drops frames that would miss their deadline
+	ThreadedWorker(Worker* worker, std::unique_ptr<FrameGovernor> governor,
+		bool keepSourceFrame, bool keepIntermediateFrame)
+		: worker(worker)
+		, frameGovernor(std::move(governor))
+		, traceName(nullptr)
+		, keepSourceFrame(keepSourceFrame)
+		, keepIntermediateFrame(keepIntermediateFrame)
+		, quit(false)
+		, finished(false)
+		, lastFetched(0)
+	{
+	}
+
+	~ThreadedWorker()
+	{
+		stop();
+	}
+
+	bool init(const std::string& videoStream)
+	{
+		if(!worker->init(videoStream))
+			return false;
+		traceName = TraceRecorder::intern(videoStream);
+		thread = std::thread(&ThreadedWorker::run, this);
+		return true;
+	}
+
+	void stop()
+	{
+		quit = true;
+		if(thread.joinable())
+			thread.join();
+	}
+
+	// Stream has ended (or grabbing failed)
+	bool isFinished() const { return finished; }
+
+	// Returns false if no new output has been published since last call
+	bool latestOutput(Output* output)
+	{
+		return outputSlot.fetch(output, &lastFetched);
+	}
+
+	FrameGovernor& governor() { return *frameGovernor; }
+
+private:
+	void run()
+	{
+		typedef FrameGovernor::clock clock;
+		int frameNumber = 0;
+		TraceRecorder::setThreadName(traceName);
+
+		while(!quit)
+		{
+			auto due = frameGovernor->nextFrameDue();
+			if(due > clock::now())
+				std::this_thread::sleep_until(due);
+
+			bool grabbed;
+			{
+				TraceSpan span("grab", traceName);
+				grabbed = worker->grabFrame();
+			}
+			if(!grabbed)
+				break;
+
+			// Stale frame, grab the next one right away
+			if(!frameGovernor->admit())
+			{
+				++frameNumber;
+				continue;
+			}
+
+			auto start = clock::now();
+			{
+				TraceSpan span("process", traceName);
+				worker->processFrame();
+			}
+			auto stop = clock::now();
+
+			// Worker reuses its frames, hand out copies
+			Output output;
+			output.finalFrame = worker->finalFrame().clone();
+			if(keepSourceFrame)
+				output.sourceFrame = worker->sourceFrame().clone();
+			if(keepIntermediateFrame)
+				output.intermediateFrame = worker->intermediateFrame().clone();
+			output.processingTime = std::chrono::duration<double, std::milli>(stop - start).count();
+			output.frameNumber = frameNumber++;
+
+			outputSlot.publish(output);
+			frameGovernor->completed();
+		}
+
+		finished = true;
+	}
+
+private:
+	std::unique_ptr<Worker> worker;
+	std::unique_ptr<FrameGovernor> frameGovernor;
+	const char* traceName;
+	bool keepSourceFrame;
+	bool keepIntermediateFrame;
+
+	std::thread thread;
+	std::atomic<bool> quit;
+	std::atomic<bool> finished;
+
+	LatestValue<Output> outputSlot;
+	unsigned long long lastFetched;
+
+private:
+	ThreadedWorker(const ThreadedWorker&);
+	ThreadedWorker& operator=(const ThreadedWorker&);
+};
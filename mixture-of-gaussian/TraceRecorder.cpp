@@ -0,0 +1,241 @@
+#include "TraceRecorder.h"
+#include "MonotonicClock.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#  define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#  define TRACE_THREAD_LOCAL thread_local
+#endif
+
+namespace
+{
+	struct TraceEvent
+	{
+		const char* track; // nullptr - host thread
+		const char* name;
+		const char* detail;
+		int64_t begin;
+		int64_t end;
+	};
+
+	// Ring of the latest events, written only by its thread, read by dump()
+	struct ThreadBuffer
+	{
+		std::unique_ptr<TraceEvent[]> events;
+		size_t capacity;
+		std::atomic<size_t> count; // events ever appended
+		std::atomic<const char*> name;
+		int tid;
+	};
+
+	std::atomic<bool> traceEnabled(false);
+	size_t bufferCapacity = 0;
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+	std::set<std::string> internedStrings;
+
+	TRACE_THREAD_LOCAL ThreadBuffer* threadBuffer = nullptr;
+
+	ThreadBuffer* currentBuffer()
+	{
+		if(!threadBuffer)
+		{
+			std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+			buffer->events.reset(new TraceEvent[bufferCapacity]);
+			buffer->capacity = bufferCapacity;
+			buffer->count = 0;
+			buffer->name = nullptr;
+
+			std::lock_guard<std::mutex> lock(registryMutex);
+			buffer->tid = int(buffers.size()) + 1;
+			threadBuffer = buffer.get();
+			buffers.push_back(std::move(buffer));
+		}
+		return threadBuffer;
+	}
+
+	void append(const TraceEvent& event)
+	{
+		ThreadBuffer* buffer = currentBuffer();
+		size_t idx = buffer->count.load(std::memory_order_relaxed);
+		// Oldest event is overwritten once the ring is full
+		buffer->events[idx % buffer->capacity] = event;
+		// Publish the event to dump()
+		buffer->count.store(idx + 1, std::memory_order_release);
+	}
+
+	void writeString(std::ostream& strm, const char* str)
+	{
+		strm << '"';
+		for(; *str; ++str)
+		{
+			char c = *str;
+			if(c == '"' || c == '\\')
+				strm << '\\' << c;
+			else if(static_cast<unsigned char>(c) < 0x20)
+				strm << ' ';
+			else
+				strm << c;
+		}
+		strm << '"';
+	}
+
+	void writeSpan(std::ostream& strm, const TraceEvent& event, int pid, int tid, bool* first)
+	{
+		strm << (*first ? "\n" : ",\n");
+		*first = false;
+
+		strm << "{\"name\":";
+		writeString(strm, event.name);
+		strm << ",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tid
+			<< ",\"ts\":" << event.begin / 1000 << "." << event.begin % 1000 / 100
+			<< ",\"dur\":" << (event.end - event.begin) / 1000.0;
+		if(event.detail)
+		{
+			strm << ",\"args\":{\"stream\":";
+			writeString(strm, event.detail);
+			strm << "}";
+		}
+		strm << "}";
+	}
+
+	void writeTrackName(std::ostream& strm, int pid, int tid, const char* name, bool* first)
+	{
+		strm << (*first ? "\n" : ",\n");
+		*first = false;
+
+		strm << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << tid
+			<< ",\"args\":{\"name\":";
+		writeString(strm, name);
+		strm << "}}";
+	}
+}
+
+void TraceRecorder::enable(size_t eventsPerThread)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	if(traceEnabled || eventsPerThread == 0)
+		return;
+	bufferCapacity = eventsPerThread;
+	traceEnabled = true;
+}
+
+bool TraceRecorder::enabled()
+{
+	return traceEnabled.load(std::memory_order_relaxed);
+}
+
+int64_t TraceRecorder::now()
+{
+	return MonotonicClock::nanoseconds();
+}
+
+void TraceRecorder::record(const char* name, const char* detail, int64_t begin, int64_t end)
+{
+	if(!enabled())
+		return;
+	TraceEvent event = { nullptr, name, detail, begin, end };
+	append(event);
+}
+
+void TraceRecorder::recordDevice(const char* track, const char* name, const char* detail,
+                                 int64_t begin, int64_t end)
+{
+	if(!enabled())
+		return;
+	TraceEvent event = { track, name, detail, begin, end };
+	append(event);
+}
+
+void TraceRecorder::setThreadName(const char* name)
+{
+	if(enabled())
+		currentBuffer()->name = name;
+}
+
+const char* TraceRecorder::intern(const std::string& str)
+{
+	if(!enabled())
+		return nullptr;
+	std::lock_guard<std::mutex> lock(registryMutex);
+	return internedStrings.insert(str).first->c_str();
+}
+
+bool TraceRecorder::dump(const std::string& filename)
+{
+	if(!enabled())
+		return false;
+
+	std::ofstream strm(filename.c_str(), std::ios::out | std::ios::trunc);
+	if(!strm.is_open())
+	{
+		std::cerr << "Can't write trace to " << filename << "\n";
+		return false;
+	}
+
+	const int hostPid = 1;
+	const int devicePid = 2;
+	std::map<const char*, int> deviceTracks;
+	size_t overwritten = 0;
+	bool first = true;
+	std::vector<TraceEvent> events;
+
+	strm << "{\"traceEvents\":[";
+
+	std::lock_guard<std::mutex> lock(registryMutex);
+	for(auto& buffer : buffers)
+	{
+		// Copy the ring, then keep only events its thread couldn't have
+		// overwritten meanwhile (the one being written is count + 1 - capacity)
+		const size_t capacity = buffer->capacity;
+		const size_t count = buffer->count.load(std::memory_order_acquire);
+		const size_t begin = count > capacity ? count - capacity : 0;
+		events.clear();
+		for(size_t i = begin; i < count; ++i)
+			events.push_back(buffer->events[i % capacity]);
+		const size_t countAfter = buffer->count.load(std::memory_order_acquire);
+		const size_t valid = countAfter + 1 > capacity ? countAfter + 1 - capacity : 0;
+		const size_t skip = std::min(std::max(valid, begin) - begin, events.size());
+		overwritten += begin + skip;
+
+		const char* name = buffer->name.load();
+		if(name)
+			writeTrackName(strm, hostPid, buffer->tid, name, &first);
+
+		for(size_t i = skip; i < events.size(); ++i)
+		{
+			const TraceEvent& event = events[i];
+			if(!event.track)
+			{
+				writeSpan(strm, event, hostPid, buffer->tid, &first);
+				continue;
+			}
+
+			auto track = deviceTracks.find(event.track);
+			if(track == deviceTracks.end())
+			{
+				track = deviceTracks.insert(std::make_pair(event.track, int(deviceTracks.size()) + 1)).first;
+				writeTrackName(strm, devicePid, track->second, event.track, &first);
+			}
+			writeSpan(strm, event, devicePid, track->second, &first);
+		}
+	}
+
+	strm << "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+	std::cout << "Trace written to " << filename;
+	if(overwritten > 0)
+		std::cout << " (" << overwritten << " older spans overwritten)";
+	std::cout << "\n";
+	return true;
+}
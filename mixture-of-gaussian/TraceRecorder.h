@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+//
+// Low-overhead timeline recorder. Every thread appends spans to its own
+// fixed-size ring buffer (no locks, no allocation while recording) which
+// keeps the latest spans, so a dump shows what just happened. Buffers are
+// written out as Chrome trace JSON (chrome://tracing, ui.perfetto.dev).
+// Does nothing until enable() is called.
+//
+
+class TraceRecorder
+{
+public:
+	// eventsPerThread - size of a thread's ring, older spans are overwritten
+	static void enable(size_t eventsPerThread);
+	static bool enabled();
+
+	// Monotonic host time [ns]
+	static int64_t now();
+
+	// Span on the calling thread's track. Strings must stay valid until
+	// dump() - use literals or intern()
+	static void record(const char* name, const char* detail, int64_t begin, int64_t end);
+	// Span on a named device track (e.g. OpenCL queue), recorded by the calling thread
+	static void recordDevice(const char* track, const char* name, const char* detail,
+		int64_t begin, int64_t end);
+
+	static void setThreadName(const char* name);
+	// Returns copy of the string which lives as long as the process
+	// (nullptr while tracing is disabled)
+	static const char* intern(const std::string& str);
+
+	// Writes everything recorded so far
+	static bool dump(const std::string& filename);
+};
+
+// Records span from construction to destruction
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char* name, const char* detail = nullptr)
+		: name(name)
+		, detail(detail)
+		, begin(TraceRecorder::enabled() ? TraceRecorder::now() : 0)
+	{
+	}
+
+	~TraceSpan()
+	{
+		if(begin != 0)
+			TraceRecorder::record(name, detail, begin, TraceRecorder::now());
+	}
+
+private:
+	const char* name;
+	const char* detail;
+	int64_t begin;
+
+private:
+	TraceSpan(const TraceSpan&);
+	TraceSpan& operator=(const TraceSpan&);
+};
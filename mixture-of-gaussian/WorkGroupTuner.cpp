@@ -0,0 +1,250 @@
+#include "WorkGroupTuner.h"
+#include "ConfigFile.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+namespace
+{
+	// Each candidate is run that many times, median counts
+	const int timedRuns = 5;
+
+	const int candidateSizesX[] = { 8, 16, 32, 64, 128, 256 };
+	const int candidateSizesY[] = { 1, 2, 4, 8, 16, 32 };
+
+	struct KernelLimits
+	{
+		size_t maxWorkGroupSize;
+		size_t preferredMultiple;
+		size_t maxItemsX;
+		size_t maxItemsY;
+	};
+
+	KernelLimits kernelLimits(const clw::Device& device, const clw::Kernel& kernel)
+	{
+		KernelLimits limits = { 1, 1, 1, 1 };
+
+		clGetKernelWorkGroupInfo(kernel.kernelId(), device.deviceId(),
+			CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &limits.maxWorkGroupSize, nullptr);
+		if(clGetKernelWorkGroupInfo(kernel.kernelId(), device.deviceId(),
+			CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t),
+			&limits.preferredMultiple, nullptr) != CL_SUCCESS)
+		{
+			// OpenCL 1.0 device
+			limits.preferredMultiple = 1;
+		}
+
+		size_t itemSizes[3] = { 1, 1, 1 };
+		clGetDeviceInfo(device.deviceId(), CL_DEVICE_MAX_WORK_ITEM_SIZES,
+			sizeof(itemSizes), itemSizes, nullptr);
+		limits.maxItemsX = itemSizes[0];
+		limits.maxItemsY = itemSizes[1];
+		return limits;
+	}
+
+	// Local size actually passed to the kernel
+	std::pair<int, int> localSize(int x, int y, bool flattened)
+	{
+		return flattened ? std::make_pair(x * y, 1) : std::make_pair(x, y);
+	}
+
+	// Kernel can run with this local size at all
+	bool valid(const KernelLimits& limits, int x, int y, bool flattened)
+	{
+		if(x <= 0 || y <= 0)
+			return false;
+		const std::pair<int, int> local = localSize(x, y, flattened);
+		const size_t size = size_t(local.first) * local.second;
+		return size <= limits.maxWorkGroupSize &&
+			size_t(local.first) <= limits.maxItemsX && size_t(local.second) <= limits.maxItemsY;
+	}
+
+	bool allowed(const KernelLimits& limits, int x, int y, bool flattened)
+	{
+		if(!valid(limits, x, y, flattened))
+			return false;
+		// Partially filled wavefronts/warps only waste lanes
+		const size_t size = size_t(x) * y;
+		return size % limits.preferredMultiple == 0 || size >= limits.maxWorkGroupSize;
+	}
+
+	std::string cacheKey(const clw::Device& device, const std::string& kernelKey, int width, int height)
+	{
+		std::ostringstream ss;
+		ss << device.name() << "|" << kernelKey << "|" << width << "x" << height;
+		return ss.str();
+	}
+}
+
+WorkGroupTuner::WorkGroupTuner(const std::string& cacheFile)
+	: cacheFile(cacheFile)
+{
+	load();
+}
+
+void WorkGroupTuner::tune(const clw::Device& device, const clw::Kernel& kernel,
+                          const std::string& kernelKey, int globalWidth, int globalHeight,
+                          clw::CommandQueue& queue, const SetWorkGroupSize& setWorkGroupSize,
+                          const RunKernel& run, int* workGroupSizeX, int* workGroupSizeY,
+                          bool flattened)
+{
+	if(kernel.isNull())
+		return;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	const std::string key = cacheKey(device, kernelKey, globalWidth, globalHeight);
+
+	const KernelLimits limits = kernelLimits(device, kernel);
+
+	// Cache may be stale (driver update) or edited by hand,
+	// entries the kernel can't run with are tuned again
+	auto cached = cache.find(key);
+	if(cached != cache.end())
+	{
+		if(valid(limits, cached->second.first, cached->second.second, flattened))
+		{
+			*workGroupSizeX = cached->second.first;
+			*workGroupSizeY = cached->second.second;
+			setWorkGroupSize(*workGroupSizeX, *workGroupSizeY);
+			return;
+		}
+		std::cout << "  cached work-group size " << cached->second.first << "x"
+			<< cached->second.second << " of " << kernelKey << " is invalid, tuning again\n";
+		cache.erase(cached);
+	}
+
+	std::vector<std::pair<int, int>> candidates;
+	// 1D kernel runs e.g. 16x2 and 32x1 the same way
+	auto listed = [&](int x, int y)
+	{
+		const std::pair<int, int> local = localSize(x, y, flattened);
+		return std::find_if(candidates.begin(), candidates.end(), [&](const std::pair<int, int>& c)
+			{ return localSize(c.first, c.second, flattened) == local; }) != candidates.end();
+	};
+	for(int x : candidateSizesX)
+	{
+		for(int y : candidateSizesY)
+		{
+			// No point in work-groups much bigger than the launch
+			const std::pair<int, int> local = localSize(x, y, flattened);
+			if(local.first / 2 >= globalWidth || local.second / 2 >= globalHeight)
+				continue;
+			if(allowed(limits, x, y, flattened) && !listed(x, y))
+				candidates.push_back(std::make_pair(x, y));
+		}
+	}
+	const std::pair<int, int> configured(*workGroupSizeX, *workGroupSizeY);
+	if(allowed(limits, configured.first, configured.second, flattened) &&
+		!listed(configured.first, configured.second))
+	{
+		candidates.push_back(configured);
+	}
+	if(candidates.empty())
+		return;
+
+	std::cout << "  tuning work-group size of " << kernelKey << " (" 
+		<< candidates.size() << " candidates)\n";
+
+	std::pair<int, int> best(0, 0);
+	double bestTime = 0;
+	for(auto& candidate : candidates)
+	{
+		setWorkGroupSize(candidate.first, candidate.second);
+
+		// Warm-up, first run may include lazy allocations and compilation
+		if(run().isNull())
+			continue;
+		queue.finish();
+
+		std::vector<clw::Event> events;
+		for(int i = 0; i < timedRuns; ++i)
+			events.push_back(run());
+		queue.finish();
+
+		std::vector<double> times;
+		for(auto& event : events)
+		{
+			if(!event.isNull())
+				times.push_back(double(event.finishTime() - event.startTime()));
+		}
+		if(times.empty())
+			continue;
+
+		std::nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+		const double median = times[times.size() / 2];
+		if(best.first == 0 || median < bestTime)
+		{
+			best = candidate;
+			bestTime = median;
+		}
+	}
+
+	if(best.first == 0)
+	{
+		// Nothing could run, keep the default
+		setWorkGroupSize(*workGroupSizeX, *workGroupSizeY);
+		return;
+	}
+
+	std::cout << "  best work-group size: " << best.first << "x" << best.second
+		<< " (" << bestTime * 1e-6 << " ms)\n";
+
+	*workGroupSizeX = best.first;
+	*workGroupSizeY = best.second;
+	setWorkGroupSize(best.first, best.second);
+
+	cache[key] = best;
+	save();
+}
+
+void WorkGroupTuner::load()
+{
+	std::ifstream strm(cacheFile.c_str());
+	if(!strm.is_open())
+		return;
+
+	// device|kernel|WxH = X Y
+	std::string line;
+	while(std::getline(strm, line))
+	{
+		const size_t sep = line.rfind('=');
+		if(line.empty() || line[0] == '#' || sep == std::string::npos)
+			continue;
+
+		std::string key = line.substr(0, sep);
+		key.erase(key.find_last_not_of(" \t") + 1);
+
+		std::istringstream values(line.substr(sep + 1));
+		int x = 0, y = 0;
+		if(values >> x >> y && x > 0 && y > 0)
+			cache[key] = std::make_pair(x, y);
+	}
+}
+
+void WorkGroupTuner::save()
+{
+	std::ofstream strm(cacheFile.c_str(), std::ios::out | std::ios::trunc);
+	if(!strm.is_open())
+	{
+		std::cerr << "Can't write work-group tuning cache " << cacheFile << "\n";
+		return;
+	}
+
+	strm << "# device|kernel|global size = work-group size X Y\n";
+	for(auto& entry : cache)
+		strm << entry.first << " = " << entry.second.first << " " << entry.second.second << "\n";
+}
+
+std::unique_ptr<WorkGroupTuner> createWorkGroupTuner(ConfigFile& cfg)
+{
+	if(cfg.value("AutoTune", "WorkGroupSize") != "yes")
+		return std::unique_ptr<WorkGroupTuner>();
+
+	std::string cacheFile = cfg.value("TuningCache", "WorkGroupSize");
+	if(cacheFile.empty())
+		cacheFile = "workgroup-tuning.txt";
+	return std::unique_ptr<WorkGroupTuner>(new WorkGroupTuner(cacheFile));
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <clw/clw.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+class ConfigFile;
+
+//
+// Picks local work size of OpenCL kernels by measurement. First time
+// a kernel runs on given device and global work size, every candidate size
+// allowed for that kernel (CL_KERNEL_WORK_GROUP_SIZE, max work-item sizes,
+// preferred multiple) is timed and the fastest one is stored in tuning
+// cache file, so later startups only read it. Thread-safe, streams
+// initialized concurrently share one tuner (and don't tune at the same time).
+//
+
+class WorkGroupTuner
+{
+public:
+	typedef std::function<void(int workGroupSizeX, int workGroupSizeY)> SetWorkGroupSize;
+	typedef std::function<clw::Event()> RunKernel;
+
+	// cacheFile - read now, rewritten whenever a new kernel is tuned
+	explicit WorkGroupTuner(const std::string& cacheFile);
+
+	// kernelKey - kernel name plus build variant (e.g. number of mixtures).
+	// globalWidth/Height - global work size the kernel is launched with
+	// (not the frame size, e.g. 1/4 of the width if a work-item does 4 pixels).
+	// run must enqueue the kernel once on queue (with profiling enabled),
+	// current local size is set through setWorkGroupSize. On return
+	// workGroupSizeX/Y hold the best size, they should be initialized with
+	// the default one (used as one of candidates and as a fallback).
+	// flattened - kernel is 1D and runs with local size (X * Y, 1)
+	void tune(const clw::Device& device, const clw::Kernel& kernel,
+		const std::string& kernelKey, int globalWidth, int globalHeight,
+		clw::CommandQueue& queue, const SetWorkGroupSize& setWorkGroupSize,
+		const RunKernel& run, int* workGroupSizeX, int* workGroupSizeY,
+		bool flattened = false);
+
+private:
+	void load();
+	void save();
+
+private:
+	std::string cacheFile;
+	std::mutex mutex;
+	// device|kernel|global WxH -> best local size
+	std::map<std::string, std::pair<int, int>> cache;
+
+private:
+	WorkGroupTuner(const WorkGroupTuner&);
+	WorkGroupTuner& operator=(const WorkGroupTuner&);
+};
+
+// Reads AutoTune and TuningCache from [WorkGroupSize], nullptr if tuning is off
+std::unique_ptr<WorkGroupTuner> createWorkGroupTuner(ConfigFile& cfg);
@@ -2,19 +2,14 @@
 
 #include "ConfigFile.h"
 #include "FrameGrabber.h"
+#include "TraceRecorder.h"
 
 #include <iostream>
 
-enum EBayerFilter
-{
-	Bayer_RG,
-	Bayer_BG,
-	Bayer_GR,
-	Bayer_GB
-};
-
-WorkerCPU::WorkerCPU(ConfigFile& cfg)
-	: showIntermediateFrame(false)
+WorkerCPU::WorkerCPU(const StreamConfig& cfg)
+	: grayCode(CV_BGR2GRAY)
+	, showIntermediateFrame(false)
+	, upscaleMask(false)
 	, cfg(cfg)
 {}
 
@@ -29,19 +24,7 @@ bool WorkerCPU::init(const std::string& videoStream)
 	}
 
 	// Inicjalizuj frame grabbera
-#if defined(SAPERA_SUPPORT)
-	// Sprawdz suffix videoStream (.ccf)
-	size_t pos = videoStream.find_last_of(".ccf");
-	if(pos+1 == videoStream.length())
-	{
-		grabber = std::unique_ptr<FrameGrabber>(new SaperaFrameGrabber());
-	}
-	else
-#endif
-	{
-		grabber = std::unique_ptr<FrameGrabber>(new OpenCvFrameGrabber());
-	}
-
+	grabber = createFrameGrabber(videoStream, cfg);
 	if(!grabber->init(videoStream))
 		return false;
 	dstFrame = cv::Mat(grabber->frameHeight(), grabber->frameWidth(), CV_8UC1);
@@ -50,24 +33,44 @@ bool WorkerCPU::init(const std::string& videoStream)
 	int width = grabber->frameWidth();
 	int height = grabber->frameHeight();
 	int channels = grabber->frameNumChannels();
+	int pixelDepth = grabber->framePixelDepth();
 
 	mog = cv::BackgroundSubtractorMOG(200, nmixtures,
 		std::stof(cfg.value("BackgroundRatio", "MogParameters")));
 	mog.initialize(cv::Size(height, width), CV_8UC1);
 
+	if(pixelDepth > 8)
+	{
+		// OpenCV's MoG works only with 8 bits
+		createNativeMog(width, height, pixelDepth, nmixtures);
+	}
+
 	std::cout << "\n  frame width: " << width <<
 		"\n  frame height: " << height << 
 		"\n  num channels: " << channels << "x" << grabber->framePixelDepth() << " bits \n";
 	//inputFrameSize = width * height * channels * sizeof(cl_uchar);
 
-	if(channels == 3)
+	std::string bayerCfg = cfg.value("Bayer", "General");
+
+	if(pixelDepth > 8 && (channels != 1 || (grabber->needBayer() && bayerCfg != "none")))
+	{
+		std::cerr << "Frames with more than 8 bits are supported only for monochrome format\n";
+		return false;
+	}
+
+	if(channels == 3 || channels == 4)
 	{
+		const bool rgbOrder = cfg.value("ChannelOrder", "General") == "RGB";
+		if(channels == 3)
+			grayCode = rgbOrder ? CV_RGB2GRAY : CV_BGR2GRAY;
+		else
+			grayCode = rgbOrder ? CV_RGBA2GRAY : CV_BGRA2GRAY;
 		std::cout << "  preprocessing frame: grayscalling\n";
 		preprocess = 1;
 	}
-	else if(channels == 1 && grabber->needBayer())
+	else if(channels == 1 && grabber->needBayer() && bayerCfg != "none")
 	{
-		std::string bayerCfg = cfg.value("Bayer", "General");
+		EBayerFilter bayer;
 		if(bayerCfg == "RG") bayer = Bayer_RG;
 		else if(bayerCfg == "BG") bayer = Bayer_BG;
 		else if(bayerCfg == "GR") bayer = Bayer_GR;
@@ -77,8 +80,21 @@ bool WorkerCPU::init(const std::string& videoStream)
 			std::cerr << "Unknown 'Bayer' parameter (must be RG, BG, GR or GB)";
 			return false;
 		}
-		std::cout << "  preprocessing frame: bayer " << bayerCfg << "\n";
+		// Binning halves the frame, MoG then runs at that size
+		const bool binned = cfg.value("BayerKernel", "General") == "binned";
+		bayerFilter.init(width, height, bayer, binned);
+		std::cout << "  preprocessing frame: bayer " << bayerCfg 
+			<< (binned ? " (binned, half resolution)\n" : "\n");
 		preprocess = 2;
+
+		if(binned)
+		{
+			width = bayerFilter.outputWidth();
+			height = bayerFilter.outputHeight();
+			dstFrame = cv::Mat(height, width, CV_8UC1);
+			mog.initialize(cv::Size(height, width), CV_8UC1);
+			upscaleMask = cfg.value("UpscaleMask", "General") == "yes";
+		}
 	}
 	else
 	{
@@ -86,6 +102,16 @@ bool WorkerCPU::init(const std::string& videoStream)
 		preprocess = 0;
 	}
 
+	if(!roi.init(cfg, grabber->frameWidth(), grabber->frameHeight(), width, height))
+		return false;
+	if(!roi.isFullFrame())
+	{
+		// OpenCV's MoG always models whole frame
+		if(!mogNative)
+			createNativeMog(width, height, pixelDepth, nmixtures);
+		mogNative->setRegionOfInterest(&roi);
+	}
+
 	showIntermediateFrame = cfg.value("ShowIntermediateFrame", "General") == "yes";
 	if(showIntermediateFrame)
 		interFrame = cv::Mat(height, width, CV_8UC1);
@@ -93,25 +119,32 @@ bool WorkerCPU::init(const std::string& videoStream)
 	return true;
 }
 
+void WorkerCPU::createNativeMog(int width, int height, int pixelDepth, int nmixtures)
+{
+	mogNative = std::unique_ptr<MixtureOfGaussianCPU>(
+		new MixtureOfGaussianCPU(height, width, 200, pixelDepth, nmixtures));
+	mogNative->setMixtureParameters(
+		std::stof(cfg.value("VarianceThreshold", "MogParameters")),
+		std::stof(cfg.value("BackgroundRatio", "MogParameters")),
+		std::stof(cfg.value("InitialWeight", "MogParameters")),
+		std::stof(cfg.value("InitialVariance", "MogParameters")),
+		std::stof(cfg.value("MinVariance", "MogParameters")));
+}
+
 void WorkerCPU::processFrame()
 {
 	cv::Mat sourceMogFrame;
+	const int64_t traceBegin = TraceRecorder::enabled() ? TraceRecorder::now() : 0;
 
 	// Grayscalling
 	if(preprocess == 1)
 	{
-		cv::cvtColor(srcFrame, sourceMogFrame, CV_BGR2GRAY);
+		cv::cvtColor(srcFrame, sourceMogFrame, grayCode);
 	}
 	// Bayer filter
 	else if(preprocess == 2)
 	{
-		switch(bayer)
-		{
-		case Bayer_RG: cv::cvtColor(srcFrame, sourceMogFrame, CV_BayerRG2GRAY); break;
-		case Bayer_BG: cv::cvtColor(srcFrame, sourceMogFrame, CV_BayerBG2GRAY); break;
-		case Bayer_GR: cv::cvtColor(srcFrame, sourceMogFrame, CV_BayerGR2GRAY); break;
-		case Bayer_GB: cv::cvtColor(srcFrame, sourceMogFrame, CV_BayerGB2GRAY); break;
-		}			
+		sourceMogFrame = bayerFilter.convert(srcFrame);
 	}
 	// Passthrough
 	else
@@ -122,7 +155,17 @@ void WorkerCPU::processFrame()
 	if(showIntermediateFrame && preprocess != 0)
 		interFrame = sourceMogFrame;
 
-	mog(sourceMogFrame, dstFrame, learningRate);
+	if(traceBegin != 0)
+		TraceRecorder::record("preprocess", nullptr, traceBegin, TraceRecorder::now());
+
+	TraceSpan span("mog");
+	if(mogNative)
+		(*mogNative)(sourceMogFrame, dstFrame, learningRate);
+	else
+		mog(sourceMogFrame, dstFrame, learningRate);
+
+	if(upscaleMask)
+		bayerFilter.upscaleMask(dstFrame, upscaledFrame);
 }
 
 bool WorkerCPU::grabFrame()
@@ -5,36 +5,51 @@
 #include <opencv2/core/core.hpp>
 #include <opencv2/video/video.hpp>
 
+#include "MixtureOfGaussianCPU.h"
+#include "BayerFilterCPU.h"
+#include "RegionOfInterest.h"
+#include "ConfigFile.h"
+
 class FrameGrabber;
-class ConfigFile;
 
 class WorkerCPU
 {
 public:
-	WorkerCPU(ConfigFile& cfg);
+	WorkerCPU(const StreamConfig& cfg);
 	bool init(const std::string& videoStream);
 	void processFrame();
 	bool grabFrame();
 
-	const cv::Mat& finalFrame() const { return dstFrame; }
+	const cv::Mat& finalFrame() const { return upscaleMask ? upscaledFrame : dstFrame; }
 	const cv::Mat& sourceFrame() const { return srcFrame; }
 	const cv::Mat& intermediateFrame() const { return interFrame; }
 
+private:
+	// Own MoG engine with parameters of the stream (same as on GPU)
+	void createNativeMog(int width, int height, int pixelDepth, int nmixtures);
+
 private:
 	int preprocess; // 0 - no preprocess (frame is gray)
 	                // 1 - frame is rgb, grayscaling
 	                // 2 - frame needs bayerFilter
+	int grayCode; // cvtColor code of grayscaling (channel order, alpha)
 	bool showIntermediateFrame;
+	bool upscaleMask; // binned Bayer: mask scaled back to sensor resolution
 
 	std::unique_ptr<FrameGrabber> grabber;
 	cv::Mat srcFrame;
 	cv::Mat dstFrame;
+	cv::Mat upscaledFrame;
 	cv::Mat interFrame;
 
-	int bayer;
+	BayerFilterCPU bayerFilter;
 	cv::BackgroundSubtractorMOG mog;
+	// Used instead of OpenCV's MoG for frames with more than 8 bits
+	// and when only region of interest is modelled
+	std::unique_ptr<MixtureOfGaussianCPU> mogNative;
+	RegionOfInterest roi;
 
-	ConfigFile& cfg;
+	StreamConfig cfg;
 	float learningRate;
 
 private:
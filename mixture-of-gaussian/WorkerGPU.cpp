@@ -1,26 +1,67 @@
 #include "WorkerGPU.h"
 #include "ConfigFile.h"
 #include "FrameGrabber.h"
+#include "WorkGroupTuner.h"
+#include "TraceRecorder.h"
 
+#include <opencv2/imgproc/imgproc.hpp>
 #include <iostream>
 
 WorkerGPU::WorkerGPU(const clw::Context& context,
 	const clw::Device& device, 
-	const clw::CommandQueue& queue,
-	ConfigFile& cfg)
+	const StreamConfig& cfg,
+	WorkGroupTuner* tuner)
 	: context(context)
 	, device(device)
-	, queue(queue)
+	, queue(this->context.createCommandQueue(clw::Property_ProfilingEnabled, this->device))
 	, inputFrameSize(0)
 	, showIntermediateFrame(false)
+	, upscaleMask(false)
+	, padUpload(false)
+	, traceTrack(nullptr)
 	, mogGPU(context, device, queue)
 	, grayscaleGPU(context, device, queue)
 	, bayerFilterGPU(context, device, queue)
 	, cfg(cfg)
+	, tuner(tuner)
 {
 }
 
 bool WorkerGPU::init(const std::string& videoStream)
+{
+	// Inicjalizuj frame grabbera
+	grabber = createFrameGrabber(videoStream, cfg);
+	if(!grabber->init(videoStream))
+		return false;
+	source = videoStream;
+	traceTrack = TraceRecorder::intern(device.name() + ": " + source);
+
+	return initProcessing();
+}
+
+bool WorkerGPU::migrateFrom(WorkerGPU& other)
+{
+	if(!other.grabber)
+		return false;
+
+	grabber = std::move(other.grabber);
+	srcFrame = other.srcFrame;
+	source = other.source;
+	traceTrack = TraceRecorder::intern(device.name() + ": " + source);
+	if(!initProcessing())
+	{
+		// Leave the other worker as it was
+		other.grabber = std::move(grabber);
+		return false;
+	}
+
+	std::vector<float> mixtureData;
+	int frameCount;
+	other.mogGPU.downloadModel(&mixtureData, &frameCount);
+	return mogGPU.uploadModel(mixtureData, frameCount);
+}
+
+bool WorkerGPU::initProcessing()
 {
 	learningRate = std::stof(cfg.value("LearningRate", "MogParameters"));
 	const int nmixtures = std::stoi(cfg.value("NumMixtures", "MogParameters"));
@@ -39,29 +80,30 @@ bool WorkerGPU::init(const std::string& videoStream)
 		return false;
 	}
 
-	// Inicjalizuj frame grabbera
-
-#if defined(SAPERA_SUPPORT)
-	// Sprawdz suffix videoStream (.ccf)
-	size_t pos = videoStream.find_last_of(".ccf");
-	if(pos+1 == videoStream.length())
-	{
-		grabber = std::unique_ptr<FrameGrabber>(new SaperaFrameGrabber());
-	}
-	else
-#endif
-	{
-		grabber = std::unique_ptr<FrameGrabber>(new OpenCvFrameGrabber());
-	}
-		
-	if(!grabber->init(videoStream))
-		return false;
-	dstFrame = cv::Mat(grabber->frameHeight(), grabber->frameWidth(), CV_8UC1);
-
 	// Pobierz dane o formacie ramki
 	int width = grabber->frameWidth();
 	int height = grabber->frameHeight();
 	int channels = grabber->frameNumChannels();
+	int pixelDepth = grabber->framePixelDepth();
+	std::string bayerCfg = cfg.value("Bayer", "General");
+
+	if(pixelDepth > 8 && (channels != 1 || (grabber->needBayer() && bayerCfg != "none")))
+	{
+		std::cerr << "Frames with more than 8 bits are supported only for monochrome format\n";
+		return false;
+	}
+
+	// Binned Bayer filter halves the frame, MoG then runs at that size
+	const std::string bayerKernelCfg = cfg.value("BayerKernel", "General");
+	const bool binned = channels == 1 && grabber->needBayer() 
+		&& bayerCfg != "none" && bayerKernelCfg == "binned";
+	const int mogWidth = binned ? width / 2 : width;
+	const int mogHeight = binned ? height / 2 : height;
+	upscaleMask = binned && cfg.value("UpscaleMask", "General") == "yes";
+
+	// Mask is read back in sensor resolution when it's upscaled
+	dstFrame = upscaleMask ? cv::Mat(height, width, CV_8UC1)
+		: cv::Mat(mogHeight, mogWidth, CV_8UC1);
 
 	// Initialize MoG on GPU
 	mogGPU.setMixtureParameters(200,
@@ -70,27 +112,38 @@ bool WorkerGPU::init(const std::string& videoStream)
 		std::stof(cfg.value("InitialWeight", "MogParameters")),
 		std::stof(cfg.value("InitialVariance", "MogParameters")),
 		std::stof(cfg.value("MinVariance", "MogParameters")));
-	mogGPU.init(width, height, workGroupSizeX, workGroupSizeY, nmixtures);
+	if(!roi.init(cfg, width, height, mogWidth, mogHeight))
+		return false;
+	mogGPU.setRegionOfInterest(&roi);
+	mogGPU.init(mogWidth, mogHeight, workGroupSizeX, workGroupSizeY, nmixtures, pixelDepth);
 
 	std::cout << "\n  frame width: " << width <<
 		"\n  frame height: " << height << 
 		"\n  num channels: " << channels << "x" << grabber->framePixelDepth() << " bits \n";
 	inputFrameSize = width * height * channels * sizeof(cl_uchar);
 
-	if(channels == 3)
+	if(channels == 3 || channels == 4)
 	{
-		std::cout << "  preprocessing frame: grayscalling\n";
+		const EChannelOrder channelOrder = cfg.value("ChannelOrder", "General") == "RGB"
+			? ChannelOrder_RGB : ChannelOrder_BGR;
+		// 3-byte pixels are padded to 4 on upload unless packed upload is asked for
+		const bool padded = channels == 4 || cfg.value("ColorUpload", "General") != "packed";
+		padUpload = channels == 3 && padded;
+		std::cout << "  preprocessing frame: grayscalling" 
+			<< (padded ? " (4 bytes per pixel)\n" : "\n");
 
 		// Initialize Grayscaling on GPU
-		grayscaleGPU.init(width, height, workGroupSizeX, workGroupSizeY);
+		grayscaleGPU.init(width, height, workGroupSizeX, workGroupSizeY, channelOrder,
+			padded ? ColorLayout_Padded : ColorLayout_Packed);
 		preprocess = 1;
+		if(padUpload)
+			inputFrameSize = width * height * 4 * sizeof(cl_uchar);
 
 		clFrame = context.createBuffer
 			(clw::Access_ReadOnly, clw::Location_Device, inputFrameSize);
 	}
-	else if(channels == 1 && grabber->needBayer())
+	else if(channels == 1 && grabber->needBayer() && bayerCfg != "none")
 	{
-		std::string bayerCfg = cfg.value("Bayer", "General");
 		EBayerFilter bayer;
 		if(bayerCfg == "RG") bayer = Bayer_RG;
 		else if(bayerCfg == "BG") bayer = Bayer_BG;
@@ -101,9 +154,17 @@ bool WorkerGPU::init(const std::string& videoStream)
 			std::cerr << "Unknown 'Bayer' parameter (must be RG, BG, GR or GB)";
 			return false;
 		}
-		std::cout << "  preprocessing frame: bayer " << bayerCfg << "\n";
+		// Tiled kernel unless other one is asked for
+		EBayerKernel kernelType = BayerKernel_Tiled;
+		if(bayerKernelCfg == "simple") kernelType = BayerKernel_Simple;
+		else if(bayerKernelCfg == "binned") kernelType = BayerKernel_Binned;
+		std::cout << "  preprocessing frame: bayer " << bayerCfg 
+			<< (kernelType == BayerKernel_Tiled ? " (tiled)\n" 
+				: kernelType == BayerKernel_Binned ? " (binned, half resolution)\n" : "\n");
 
-		bayerFilterGPU.init(width, height, workGroupSizeX, workGroupSizeX, bayer);
+		bayerFilterGPU.init(width, height, workGroupSizeX, workGroupSizeY, bayer, kernelType);
+		if(upscaleMask)
+			bayerFilterGPU.initMaskUpscale(workGroupSizeX, workGroupSizeY);
 		preprocess = 2;
 
 		clFrame = context.createBuffer
@@ -115,12 +176,31 @@ bool WorkerGPU::init(const std::string& videoStream)
 		preprocess = 0;
 		clFrameGray = context.createImage2D(
 			clw::Access_ReadOnly, clw::Location_Device,
-			clw::ImageFormat(clw::Order_R, clw::Type_Normalized_UInt8), width, height);
+			clw::ImageFormat(clw::Order_R, pixelDepth > 8 
+				? clw::Type_Normalized_UInt16
+				: clw::Type_Normalized_UInt8), width, height);
+	}
+
+	// Configured size is only the starting point, every kernel gets its own
+	if(tuner)
+	{
+		int x = workGroupSizeX, y = workGroupSizeY;
+		if(preprocess == 1)
+			grayscaleGPU.tuneWorkGroupSize(*tuner, clFrame, &x, &y);
+		else if(preprocess == 2)
+			bayerFilterGPU.tuneWorkGroupSize(*tuner, clFrame, &x, &y);
+
+		clw::Image2D sampleFrame = preprocess == 1 ? grayscaleGPU.output()
+			: preprocess == 2 ? bayerFilterGPU.output()
+			: clFrameGray;
+		x = workGroupSizeX;
+		y = workGroupSizeY;
+		mogGPU.tuneWorkGroupSize(*tuner, sampleFrame, &x, &y);
 	}
 
 	showIntermediateFrame = cfg.value("ShowIntermediateFrame", "General") == "yes";
 	if(showIntermediateFrame)
-		interFrame = cv::Mat(height, width, CV_8UC1);
+		interFrame = cv::Mat(mogHeight, mogWidth, CV_8UC1);
 
 	return true;
 }
@@ -128,39 +208,56 @@ bool WorkerGPU::init(const std::string& videoStream)
 clw::EventList WorkerGPU::processFrame()
 {
 	clw::Image2D sourceMogFrame;
+	clw::EventList eventList;
+
+	auto enqueued = [&](EStage stage, const clw::Event& event)
+	{
+		stageProfiler.add(stage, event);
+		eventList.append(event);
+	};
 
 	// Grayscaling
 	if(preprocess == 1)
 	{
-		clw::Event e0 = queue.asyncWriteBuffer(clFrame, srcFrame.data, 0, inputFrameSize);
-		clw::Event e1 = grayscaleGPU.process(clFrame);
+		// Alpha is only padding, kernel ignores it
+		if(padUpload)
+			cv::cvtColor(srcFrame, paddedFrame, CV_BGR2BGRA);
+		const cv::Mat& uploadFrame = padUpload ? paddedFrame : srcFrame;
+		enqueued(Stage_Upload, queue.asyncWriteBuffer(clFrame, uploadFrame.data, 0, inputFrameSize));
+		enqueued(Stage_Preprocess, grayscaleGPU.process(clFrame));
 		sourceMogFrame = grayscaleGPU.output();
 	}
 	// Bayer filter
 	else if(preprocess == 2)
 	{
-		clw::Event e0 = queue.asyncWriteBuffer(clFrame, srcFrame.data, 0, inputFrameSize);
-		clw::Event e1 = bayerFilterGPU.process(clFrame);
+		enqueued(Stage_Upload, queue.asyncWriteBuffer(clFrame, srcFrame.data, 0, inputFrameSize));
+		enqueued(Stage_Preprocess, bayerFilterGPU.process(clFrame));
+		if(!bayerFilterGPU.borderEvent().isNull())
+			enqueued(Stage_Preprocess, bayerFilterGPU.borderEvent());
 		sourceMogFrame = bayerFilterGPU.output();
 	}
 	// Passthrough
 	else
 	{
-		clw::Event e0 = queue.asyncWriteImage2D(clFrameGray, srcFrame.data, 0, 0, srcFrame.cols, srcFrame.rows);
+		enqueued(Stage_Upload, queue.asyncWriteImage2D(clFrameGray, srcFrame.data, 0, 0, srcFrame.cols, srcFrame.rows));
 		sourceMogFrame= clFrameGray;
 	}
 
 	if(showIntermediateFrame && preprocess != 0)
 	{
-		queue.asyncReadImage2D(sourceMogFrame, interFrame.data, 0, 0, interFrame.cols, interFrame.rows);
+		enqueued(Stage_Readback, queue.asyncReadImage2D(sourceMogFrame, interFrame.data, 0, 0, interFrame.cols, interFrame.rows));
 	}
 		
-	clw::Event e2 = mogGPU.process(sourceMogFrame, learningRate);
-	clw::Event e3 = queue.asyncReadImage2D(mogGPU.output(), dstFrame.data, 0, 0, dstFrame.cols, dstFrame.rows);
+	enqueued(Stage_MoG, mogGPU.process(sourceMogFrame, learningRate));
 
-	clw::EventList eventList;
-	eventList.append(e2);
-	eventList.append(e3);
+	clw::Image2D mask = mogGPU.output();
+	if(upscaleMask)
+	{
+		// Part of producing the output mask, not of the model update
+		enqueued(Stage_Readback, bayerFilterGPU.upscaleMask(mask));
+		mask = bayerFilterGPU.upscaledMask();
+	}
+	enqueued(Stage_Readback, queue.asyncReadImage2D(mask, dstFrame.data, 0, 0, dstFrame.cols, dstFrame.rows));
 
 	return eventList;
 }
@@ -169,5 +266,8 @@ bool WorkerGPU::grabFrame()
 {
 	bool success;
 	srcFrame = grabber->grab(&success);
+	// Uploads assume tightly packed rows (decoders may pad them)
+	if(success && !srcFrame.isContinuous())
+		srcFrame = srcFrame.clone();
 	return success;
 }
\ No newline at end of file
@@ -7,24 +7,41 @@
 #include "MixtureOfGaussianGPU.h"
 #include "GrayscaleGPU.h"
 #include "BayerFilterGPU.h"
+#include "RegionOfInterest.h"
+#include "ConfigFile.h"
+#include "StageProfiler.h"
 
 class FrameGrabber;
-class ConfigFile;
+class WorkGroupTuner;
 
 class WorkerGPU
 {
 public:
+	// Every worker has its own in-order queue, so streams don't serialize
+	// behind each other and can run concurrently on the device.
+	// tuner - picks work-group sizes of kernels, nullptr - use [WorkGroupSize]
 	WorkerGPU(const clw::Context& context,
 		const clw::Device& device, 
-		const clw::CommandQueue& queue,
-		ConfigFile& cfg);
+		const StreamConfig& cfg,
+		WorkGroupTuner* tuner = nullptr);
 	bool init(const std::string& videoStream);
+	// Takes over frame grabber and background model of a worker
+	// running on another device (which is left unusable on success)
+	bool migrateFrom(WorkerGPU& other);
 	clw::EventList processFrame();
 	bool grabFrame();
 
 	const cv::Mat& finalFrame() const { return dstFrame; }
 	const cv::Mat& sourceFrame() const { return srcFrame; }
 	const cv::Mat& intermediateFrame() const { return interFrame; }
+	clw::CommandQueue& commandQueue() { return queue; }
+	// Call frameFinished() on it once the queue is finished
+	StageProfiler& profiler() { return stageProfiler; }
+	// Trace track of device spans of this stream
+	const char* deviceTrack() const { return traceTrack; }
+
+private:
+	bool initProcessing();
 
 private:
 	clw::Context context;
@@ -37,17 +54,26 @@ private:
 	                // 1 - frame is rgb, grayscaling
 	                // 2 - frame needs bayerFilter
 	bool showIntermediateFrame;
+	bool upscaleMask; // binned Bayer: mask scaled back to sensor resolution
+	bool padUpload;   // 3-byte pixels are padded to 4 before upload
+	std::string source;
+	const char* traceTrack; // device spans of this stream
 
 	MixtureOfGaussianGPU mogGPU;
 	GrayscaleGPU grayscaleGPU;
 	BayerFilterGPU bayerFilterGPU;
+	RegionOfInterest roi;
 
 	std::unique_ptr<FrameGrabber> grabber;
 	cv::Mat srcFrame;
+	cv::Mat paddedFrame;
 	cv::Mat dstFrame;
 	cv::Mat interFrame;
 
-	ConfigFile& cfg;
+	StageProfiler stageProfiler;
+
+	StreamConfig cfg;
+	WorkGroupTuner* tuner;
 	float learningRate;
 
 private:
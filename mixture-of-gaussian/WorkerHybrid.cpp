@@ -0,0 +1,326 @@
+#include "WorkerHybrid.h"
+#include "ConfigFile.h"
+#include "FrameGrabber.h"
+#include "TraceRecorder.h"
+#include "WorkGroupTuner.h"
+#include "MonotonicClock.h"
+
+#include <opencv2/imgproc/imgproc.hpp>
+#include <chrono>
+#include <iostream>
+
+namespace
+{
+	// Frames between split adjustments (moving rows costs a model transfer)
+	const int retuneInterval = 30;
+	// Weight of the newest per-row cost measurement
+	const double costSmoothing = 0.2;
+}
+
+WorkerHybrid::WorkerHybrid(const clw::Context& context,
+	const clw::Device& device,
+	const StreamConfig& cfg,
+	WorkGroupTuner* tuner)
+	: context(context)
+	, device(device)
+	, queue(this->context.createCommandQueue(clw::Property_ProfilingEnabled, this->device))
+	, mogGPU(this->context, this->device, queue)
+	, preprocess(0)
+	, grayCode(CV_BGR2GRAY)
+	, showIntermediateFrame(false)
+	, upscaleMask(false)
+	, split(0)
+	, splitGranularity(1)
+	, deviceRowCost(0)
+	, hostRowCost(0)
+	, framesSinceRetune(0)
+	, traceTrack(nullptr)
+	, cfg(cfg)
+	, tuner(tuner)
+	, learningRate(-1)
+{
+}
+
+bool WorkerHybrid::init(const std::string& videoStream)
+{
+	learningRate = std::stof(cfg.value("LearningRate", "MogParameters"));
+	const int nmixtures = std::stoi(cfg.value("NumMixtures", "MogParameters"));
+	if(nmixtures <= 0 || nmixtures > maxNumMixtures)
+	{
+		std::cerr << "Parameter NumMixtures is wrong, must be between 1 and " 
+			<< maxNumMixtures << " in hybrid mode\n";
+		return false;
+	}
+
+	int workGroupSizeX = std::stoi(cfg.value("X", "WorkGroupSize"));
+	int workGroupSizeY = std::stoi(cfg.value("Y", "WorkGroupSize"));
+
+	if(workGroupSizeX <= 0 || workGroupSizeY <= 0)
+	{
+		std::cerr << "Parameter X or Y in WorkGroupSize is wrong, must be more than 0\n";
+		return false;
+	}
+
+	// Inicjalizuj frame grabbera
+	grabber = createFrameGrabber(videoStream, cfg);
+	if(!grabber->init(videoStream))
+		return false;
+	traceTrack = TraceRecorder::intern(device.name() + ": " + videoStream);
+
+	int width = grabber->frameWidth();
+	int height = grabber->frameHeight();
+	int channels = grabber->frameNumChannels();
+	int pixelDepth = grabber->framePixelDepth();
+	std::string bayerCfg = cfg.value("Bayer", "General");
+
+	if(pixelDepth > 8 && (channels != 1 || (grabber->needBayer() && bayerCfg != "none")))
+	{
+		std::cerr << "Frames with more than 8 bits are supported only for monochrome format\n";
+		return false;
+	}
+
+	std::cout << "\n  frame width: " << width <<
+		"\n  frame height: " << height << 
+		"\n  num channels: " << channels << "x" << pixelDepth << " bits \n";
+
+	// Preprocessing is done on host, both sides need the gray frame
+	if(channels == 3 || channels == 4)
+	{
+		const bool rgbOrder = cfg.value("ChannelOrder", "General") == "RGB";
+		if(channels == 3)
+			grayCode = rgbOrder ? CV_RGB2GRAY : CV_BGR2GRAY;
+		else
+			grayCode = rgbOrder ? CV_RGBA2GRAY : CV_BGRA2GRAY;
+		std::cout << "  preprocessing frame: grayscalling\n";
+		preprocess = 1;
+	}
+	else if(channels == 1 && grabber->needBayer() && bayerCfg != "none")
+	{
+		EBayerFilter bayer;
+		if(bayerCfg == "RG") bayer = Bayer_RG;
+		else if(bayerCfg == "BG") bayer = Bayer_BG;
+		else if(bayerCfg == "GR") bayer = Bayer_GR;
+		else if(bayerCfg == "GB") bayer = Bayer_GB;
+		else
+		{
+			std::cerr << "Unknown 'Bayer' parameter (must be RG, BG, GR or GB)";
+			return false;
+		}
+		// Binning halves the frame, both sides then model it at that size
+		const bool binned = cfg.value("BayerKernel", "General") == "binned";
+		bayerFilter.init(width, height, bayer, binned);
+		std::cout << "  preprocessing frame: bayer " << bayerCfg 
+			<< (binned ? " (binned, half resolution)\n" : "\n");
+		preprocess = 2;
+
+		width = bayerFilter.outputWidth();
+		height = bayerFilter.outputHeight();
+		grayFrame = cv::Mat(height, width, CV_8UC1);
+		upscaleMask = binned && cfg.value("UpscaleMask", "General") == "yes";
+	}
+	else
+	{
+		std::cout << "  preprocessing frame: none (already monochrome format)\n";
+		preprocess = 0;
+	}
+
+	if(!roi.init(cfg, grabber->frameWidth(), grabber->frameHeight(), width, height))
+		return false;
+
+	const float varianceThreshold = std::stof(cfg.value("VarianceThreshold", "MogParameters"));
+	const float backgroundRatio = std::stof(cfg.value("BackgroundRatio", "MogParameters"));
+	const float initialWeight = std::stof(cfg.value("InitialWeight", "MogParameters"));
+	const float initialVariance = std::stof(cfg.value("InitialVariance", "MogParameters"));
+	const float minVariance = std::stof(cfg.value("MinVariance", "MogParameters"));
+
+	// Both sides get the model of the whole frame, but each one uses
+	// (and keeps up to date) only its own rows
+	mogGPU.setMixtureParameters(200, varianceThreshold, backgroundRatio,
+		initialWeight, initialVariance, minVariance);
+	mogGPU.setRegionOfInterest(&roi);
+	mogGPU.setHostUpdateRule(true);
+	mogGPU.init(width, height, workGroupSizeX, workGroupSizeY, nmixtures, pixelDepth);
+
+	mogCPU = std::unique_ptr<MixtureOfGaussianCPU>(
+		new MixtureOfGaussianCPU(height, width, 200, pixelDepth, nmixtures));
+	mogCPU->setMixtureParameters(varianceThreshold, backgroundRatio,
+		initialWeight, initialVariance, minVariance);
+	mogCPU->setRegionOfInterest(&roi);
+
+	clFrameGray = context.createImage2D(
+		clw::Access_ReadOnly, clw::Location_Device,
+		clw::ImageFormat(clw::Order_R, pixelDepth > 8 
+			? clw::Type_Normalized_UInt16
+			: clw::Type_Normalized_UInt8), width, height);
+
+	dstFrame = cv::Mat(height, width, CV_8UC1);
+
+	// Split follows work-group height, so tune before it's set
+	if(tuner)
+		mogGPU.tuneWorkGroupSize(*tuner, clFrameGray, &workGroupSizeX, &workGroupSizeY);
+
+	// Start with an even split, measurements will move it
+	splitGranularity = std::max(1, std::min(workGroupSizeY, height / 4));
+	split = (height / 2) / splitGranularity * splitGranularity;
+	split = std::max(split, splitGranularity);
+
+	showIntermediateFrame = cfg.value("ShowIntermediateFrame", "General") == "yes";
+
+	return true;
+}
+
+void WorkerHybrid::processFrame()
+{
+	typedef MonotonicClock clock;
+	const int64_t traceBegin = TraceRecorder::enabled() ? TraceRecorder::now() : 0;
+
+	if(preprocess == 1)
+		cv::cvtColor(srcFrame, grayFrame, grayCode);
+	else if(preprocess == 2)
+		// Only device rows here, host ones are converted band by band
+		// while they are being modelled
+		bayerFilter.convertRows(srcFrame, grayFrame, 0, split);
+	else
+		grayFrame = srcFrame;
+
+	if(showIntermediateFrame && preprocess != 0)
+		interFrame = grayFrame;
+
+	const int rows = grayFrame.rows;
+	const int cols = grayFrame.cols;
+
+	int64_t enqueueTime = 0;
+	if(traceBegin != 0)
+	{
+		enqueueTime = TraceRecorder::now();
+		TraceRecorder::record("preprocess", nullptr, traceBegin, enqueueTime);
+	}
+
+	// Device part goes first and runs while host does its rows
+	clw::Event e0 = queue.asyncWriteImage2D(clFrameGray, grayFrame.data, 0, 0, cols, split);
+	clw::Event e1 = mogGPU.process(clFrameGray, learningRate, split);
+	clw::Event e2 = queue.asyncReadImage2D(mogGPU.output(), dstFrame.data, 0, 0, cols, split);
+	queue.flush();
+
+	auto start = clock::now();
+	{
+		TraceSpan span("host MoG");
+		if(preprocess == 2)
+		{
+			mogCPU->processRows(grayFrame, dstFrame, split, rows, learningRate,
+				[this](int bandFirst, int bandEnd)
+				{
+					bayerFilter.convertRows(srcFrame, grayFrame, bandFirst, bandEnd);
+				});
+		}
+		else
+		{
+			mogCPU->processRows(grayFrame, dstFrame, split, rows, learningRate);
+		}
+	}
+	double hostTime = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+	{
+		TraceSpan span("wait for device");
+		queue.finish();
+	}
+
+	double deviceTime = 0;
+	deviceTime += (e0.finishTime() - e0.startTime()) * 1e-6;
+	deviceTime += (e1.finishTime() - e1.startTime()) * 1e-6;
+	deviceTime += (e2.finishTime() - e2.startTime()) * 1e-6;
+
+	if(traceBegin != 0)
+	{
+		// Device clock has its own epoch, align first command's queue time with enqueue time
+		const int64_t offset = enqueueTime - int64_t(e0.queuedTime());
+		TraceRecorder::recordDevice(traceTrack, "upload", nullptr,
+			int64_t(e0.startTime()) + offset, int64_t(e0.finishTime()) + offset);
+		TraceRecorder::recordDevice(traceTrack, "MoG", nullptr,
+			int64_t(e1.startTime()) + offset, int64_t(e1.finishTime()) + offset);
+		TraceRecorder::recordDevice(traceTrack, "readback", nullptr,
+			int64_t(e2.startTime()) + offset, int64_t(e2.finishTime()) + offset);
+	}
+
+	if(upscaleMask)
+		bayerFilter.upscaleMask(dstFrame, upscaledFrame);
+
+	retuneSplit(deviceTime, hostTime);
+}
+
+bool WorkerHybrid::grabFrame()
+{
+	bool success;
+	srcFrame = grabber->grab(&success);
+	// Uploads assume tightly packed rows (decoders may pad them)
+	if(success && !srcFrame.isContinuous())
+		srcFrame = srcFrame.clone();
+	return success;
+}
+
+void WorkerHybrid::retuneSplit(double deviceTime, double hostTime)
+{
+	const int rows = dstFrame.rows;
+
+	double deviceCost = deviceTime / split;
+	double hostCost = hostTime / (rows - split);
+	deviceRowCost = deviceRowCost > 0 ? deviceRowCost + costSmoothing * (deviceCost - deviceRowCost) : deviceCost;
+	hostRowCost = hostRowCost > 0 ? hostRowCost + costSmoothing * (hostCost - hostRowCost) : hostCost;
+
+	if(++framesSinceRetune < retuneInterval || deviceRowCost + hostRowCost <= 0)
+		return;
+	framesSinceRetune = 0;
+
+	// Both sides finish at the same time when
+	// split * deviceRowCost == (rows - split) * hostRowCost
+	double ideal = rows * hostRowCost / (deviceRowCost + hostRowCost);
+	int newSplit = int(ideal / splitGranularity + 0.5) * splitGranularity;
+
+	// Keep both sides busy so their costs stay measured
+	newSplit = std::min(std::max(newSplit, splitGranularity), rows - splitGranularity);
+	if(newSplit != split)
+		moveSplit(newSplit);
+}
+
+void WorkerHybrid::moveSplit(int newSplit)
+{
+	const int nmixtures = mogGPU.numMixtures();
+	const int firstRow = std::min(split, newSplit);
+	const int numRows = std::abs(newSplit - split);
+	// Modelled pixels of consecutive rows follow each other on both sides
+	const size_t rowsSize = size_t(roi.rowOffset(firstRow + numRows)) - roi.rowOffset(firstRow);
+
+	// Device keeps planes of weights, means and variances,
+	// host keeps them interleaved per pixel
+	if(newSplit > split)
+	{
+		transferData.resize(rowsSize * nmixtures * 3);
+		const MixtureData* mptr = mogCPU->modelRow(firstRow);
+		for(size_t idx = 0; idx < rowsSize; ++idx)
+		{
+			for(int mx = 0; mx < nmixtures; ++mx, ++mptr)
+			{
+				transferData[(mx + 0 * nmixtures) * rowsSize + idx] = mptr->weight;
+				transferData[(mx + 1 * nmixtures) * rowsSize + idx] = mptr->mean;
+				transferData[(mx + 2 * nmixtures) * rowsSize + idx] = mptr->var;
+			}
+		}
+		mogGPU.uploadModelRows(firstRow, numRows, transferData);
+	}
+	else
+	{
+		mogGPU.downloadModelRows(firstRow, numRows, &transferData);
+		MixtureData* mptr = mogCPU->modelRow(firstRow);
+		for(size_t idx = 0; idx < rowsSize; ++idx)
+		{
+			for(int mx = 0; mx < nmixtures; ++mx, ++mptr)
+			{
+				mptr->weight = transferData[(mx + 0 * nmixtures) * rowsSize + idx];
+				mptr->mean = transferData[(mx + 1 * nmixtures) * rowsSize + idx];
+				mptr->var = transferData[(mx + 2 * nmixtures) * rowsSize + idx];
+			}
+		}
+	}
+
+	split = newSplit;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <opencv2/core/core.hpp>
+#include <memory>
+#include <vector>
+#include <clw/clw.h>
+
+#include "MixtureOfGaussianCPU.h"
+#include "MixtureOfGaussianGPU.h"
+#include "BayerFilterCPU.h"
+#include "RegionOfInterest.h"
+#include "ConfigFile.h"
+
+class FrameGrabber;
+class WorkGroupTuner;
+
+//
+// Splits every frame by rows: top rows go to OpenCL device, the rest
+// is processed on host cores at the same time. Each side keeps the model
+// of its own rows only; the split follows measured per-row cost of both
+// sides and rows changing hands take their mixtures with them.
+//
+
+class WorkerHybrid
+{
+public:
+	// tuner - picks work-group size of MoG kernel, nullptr - use [WorkGroupSize]
+	WorkerHybrid(const clw::Context& context,
+		const clw::Device& device,
+		const StreamConfig& cfg,
+		WorkGroupTuner* tuner = nullptr);
+	bool init(const std::string& videoStream);
+	void processFrame();
+	bool grabFrame();
+
+	const cv::Mat& finalFrame() const { return upscaleMask ? upscaledFrame : dstFrame; }
+	const cv::Mat& sourceFrame() const { return srcFrame; }
+	const cv::Mat& intermediateFrame() const { return interFrame; }
+
+	// First row processed on host
+	int splitRow() const { return split; }
+
+private:
+	void retuneSplit(double deviceTime, double hostTime);
+	void moveSplit(int newSplit);
+
+private:
+	clw::Context context;
+	clw::Device device;
+	clw::CommandQueue queue;
+	clw::Image2D clFrameGray;
+
+	MixtureOfGaussianGPU mogGPU;
+	std::unique_ptr<MixtureOfGaussianCPU> mogCPU;
+	RegionOfInterest roi;
+
+	int preprocess; // 0 - no preprocess (frame is gray)
+	                // 1 - frame is rgb, grayscaling
+	                // 2 - frame needs bayerFilter
+	int grayCode; // cvtColor code of grayscaling (channel order, alpha)
+	BayerFilterCPU bayerFilter;
+	bool showIntermediateFrame;
+	bool upscaleMask; // binned Bayer: mask scaled back to sensor resolution
+
+	std::unique_ptr<FrameGrabber> grabber;
+	cv::Mat srcFrame;
+	cv::Mat grayFrame;
+	cv::Mat dstFrame;
+	cv::Mat upscaledFrame;
+	cv::Mat interFrame;
+
+	int split;
+	int splitGranularity; // work-group height, keeps device rows aligned
+	double deviceRowCost; // [ms]
+	double hostRowCost;   // [ms]
+	int framesSinceRetune;
+	std::vector<float> transferData;
+	const char* traceTrack; // device spans of this stream
+
+	StreamConfig cfg;
+	WorkGroupTuner* tuner;
+	float learningRate;
+
+private:
+	WorkerHybrid(const WorkerHybrid&);
+	WorkerHybrid& operator=(const WorkerHybrid&);
+};
@@ -1,6 +1,6 @@
 __constant uint3 shift = { 0, 2, 2 };
 __constant uint3 ddiv = { 2, 5, 2 };
-__constant uint3 coeff = { 4899, 9617, 1864 };
+__constant uint3 coeff = { 4899, 9617, 1868 };
 
 __attribute__((always_inline))
  bool opTrue(bool o) { return o; }
@@ -13,26 +13,25 @@ int index2(int x, int y, int row_pitch)
 
 __attribute__((always_inline))
 int descale(int x, int n)
-{ return (x + (1 << (n + 1))) >> n; }
+{ return (x + (1 << (n - 1))) >> n; }
 
 #define RADIUSX 1
 #define RADIUSY 1
 
-uchar3 convert_bayer2rgb(__global uchar* src, const int imgw, int2 gid, bool x_odd, bool y_odd)
+// Coordinates outside the frame are reflected (x = -1 -> 1), which keeps
+// the Bayer pattern intact. Also clamps what's past the frame by more than
+// 1 pixel (last work-group of tiled kernels).
+__attribute__((always_inline))
+int mirror(int x, int size)
 {
-	__private uint v[9];
-	
-	// fetch pixel with its full 3x3 context
-	#pragma unroll
-	for(int y = 0; y < 3; ++y) 
-	{
-		#pragma unroll
-		for(int x = 0; x < 3; ++x)
-		{
-			v[index2(x,y,3)] = src[index2(gid.x + x - 1, gid.y + y - 1, imgw)];
-		}
-	}
+	x = x < 0 ? -x : x;
+	x = x >= size ? 2 * size - 2 - x : x;
+	return clamp(x, 0, size - 1);
+}
 
+// v - pixel with its full 3x3 context, row by row
+uchar3 bayer2rgb(const uint* v, bool x_odd, bool y_odd)
+{
 	uint sum0 = v[3] + v[5];
 	uint sum1 = v[1] + v[7];
 	uint sum2 = v[0] + v[2];
@@ -61,6 +60,69 @@ uchar3 convert_bayer2rgb(__global uchar* src, const int imgw, int2 gid, bool x_o
 	return out;
 }
 
+__attribute__((always_inline))
+uchar rgb2gray(uchar3 rgb)
+{
+	uint3 scaled = convert_uint3(rgb) * coeff;
+	return convert_uchar_sat(descale(scaled.x + scaled.y + scaled.z, 14));
+}
+
+uchar3 convert_bayer2rgb(__global uchar* src, const int imgw, int2 gid, bool x_odd, bool y_odd)
+{
+	__private uint v[9];
+	
+	// fetch pixel with its full 3x3 context
+	#pragma unroll
+	for(int y = 0; y < 3; ++y) 
+	{
+		#pragma unroll
+		for(int x = 0; x < 3; ++x)
+		{
+			v[index2(x,y,3)] = src[index2(gid.x + x - 1, gid.y + y - 1, imgw)];
+		}
+	}
+
+	return bayer2rgb(v, x_odd, y_odd);
+}
+
+// For border pixels, context outside the frame is mirrored
+uchar3 convert_bayer2rgb_mirrored(__global uchar* src, const int2 size, int2 gid, bool x_odd, bool y_odd)
+{
+	__private uint v[9];
+	
+	#pragma unroll
+	for(int y = 0; y < 3; ++y) 
+	{
+		#pragma unroll
+		for(int x = 0; x < 3; ++x)
+		{
+			v[index2(x,y,3)] = src[index2(mirror(gid.x + x - 1, size.x), mirror(gid.y + y - 1, size.y), size.x)];
+		}
+	}
+
+	return bayer2rgb(v, x_odd, y_odd);
+}
+
+// Maps index to a pixel of frame's 1 pixel wide border: top row, bottom row,
+// left and right column (without corners). (-1, -1) past the last one.
+int2 border_pixel(int i, const int2 size)
+{
+	if(i < size.x)
+		return (int2)(i, 0);
+	i -= size.x;
+	if(i < size.x)
+		return (int2)(i, size.y - 1);
+	i -= size.x;
+
+	const int side = max(size.y - 2, 0);
+	if(i < side)
+		return (int2)(0, i + 1);
+	i -= side;
+	if(i < side)
+		return (int2)(size.x - 1, i + 1);
+	return (int2)(-1, -1);
+}
+
 #define DEFINE_BAYER_KERNEL_RGB(name, xo, yo) \
 	__kernel void name(__global uchar* src, __write_only image2d_t dst, const int2 size) \
 	{ \
@@ -72,18 +134,27 @@ uchar3 convert_bayer2rgb(__global uchar* src, const int imgw, int2 gid, bool x_o
 		write_imagef(dst, gid, (float4)(out.x / 255.0f, out.y / 255.0f, out.z / 255.0f, 0)); \
 	}
 
+// Interior kernel runs over (size - 2) pixels offset by the radius and needs no
+// edge handling, name##_border covers the remaining 1 pixel wide frame border
+// (1D, 2 * (width + height) - 4 work-items)
 #define DEFINE_BAYER_KERNEL_GRAY(name, xo, yo) \
 	__kernel void name(__global uchar* src, __write_only image2d_t dst, const int2 size) \
 	{ \
-		int2 gid = { get_global_id(0), get_global_id(1) }; \
+		int2 gid = { get_global_id(0) + RADIUSX, get_global_id(1) + RADIUSY }; \
 		if(gid.x + RADIUSX >= size.x || gid.y + RADIUSY >= size.y) return; \
-		int2 lid = { get_local_id(0), get_local_id(1) }; \
 		bool x_odd = gid.x & 0x01; \
 		bool y_odd = gid.y & 0x01; \
 		uchar3 out = convert_bayer2rgb(src, size.x, gid, xo(x_odd), yo(y_odd)); \
-		uint3 out_scaled = convert_uint3(out) * coeff; \
-		uchar gray = convert_uchar_sat(descale(out_scaled.x + out_scaled.y + out_scaled.z, 14)); \
-		write_imagef(dst, gid, (float4) (gray / 255.0f)); \
+		write_imagef(dst, gid, (float4) (rgb2gray(out) / 255.0f)); \
+	} \
+	__kernel void name##_border(__global uchar* src, __write_only image2d_t dst, const int2 size) \
+	{ \
+		int2 gid = border_pixel(get_global_id(0), size); \
+		if(gid.x < 0) return; \
+		bool x_odd = gid.x & 0x01; \
+		bool y_odd = gid.y & 0x01; \
+		uchar3 out = convert_bayer2rgb_mirrored(src, size, gid, xo(x_odd), yo(y_odd)); \
+		write_imagef(dst, gid, (float4) (rgb2gray(out) / 255.0f)); \
 	}
 
 DEFINE_BAYER_KERNEL_RGB(convert_rg2rgb, opTrue,  opTrue)
@@ -94,4 +165,156 @@ DEFINE_BAYER_KERNEL_RGB(convert_bg2rgb, opFalse, opFalse)
 DEFINE_BAYER_KERNEL_GRAY(convert_rg2gray, opTrue,  opTrue)
 DEFINE_BAYER_KERNEL_GRAY(convert_gb2gray, opTrue,  opFalse)
 DEFINE_BAYER_KERNEL_GRAY(convert_gr2gray, opFalse, opTrue)
-DEFINE_BAYER_KERNEL_GRAY(convert_bg2gray, opFalse, opFalse)
\ No newline at end of file
+DEFINE_BAYER_KERNEL_GRAY(convert_bg2gray, opFalse, opFalse)
+//
+// Tiled variants: work-group loads its source tile (plus 1 pixel apron) to
+// local memory once, every work-item then converts one 2x2 Bayer quad, 
+// so each position in the quad has fixed color and nothing diverges.
+// Global size is half of the frame in both dimensions. Apron outside the
+// frame is mirrored (x = -1 -> 1), which keeps the Bayer pattern intact.
+//
+
+// Tile is passed as __local argument of (2 * lx + 2) * (2 * ly + 2) bytes,
+// sized on host for the local size actually used.
+void load_bayer_tile(__global const uchar* src, __local uchar* tile, const int2 size)
+{
+	const int2 lsize = { get_local_size(0), get_local_size(1) };
+	const int2 origin = { 2 * get_group_id(0) * lsize.x - 1, 2 * get_group_id(1) * lsize.y - 1 };
+	const int tileWidth = 2 * lsize.x + 2;
+	const int tileSize = tileWidth * (2 * lsize.y + 2);
+
+	for(int i = get_local_id(1) * lsize.x + get_local_id(0); i < tileSize; i += lsize.x * lsize.y)
+	{
+		const int x = mirror(origin.x + i % tileWidth, size.x);
+		const int y = mirror(origin.y + i / tileWidth, size.y);
+		tile[i] = src[index2(x, y, size.x)];
+	}
+
+	barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+// 4x4 window around the quad of this work-item
+void fetch_quad_context(__local const uchar* tile, uint* w)
+{
+	const int tileWidth = 2 * get_local_size(0) + 2;
+	const int x0 = 2 * get_local_id(0);
+	const int y0 = 2 * get_local_id(1);
+
+	#pragma unroll
+	for(int y = 0; y < 4; ++y)
+	{
+		#pragma unroll
+		for(int x = 0; x < 4; ++x)
+			w[index2(x, y, 4)] = tile[index2(x0 + x, y0 + y, tileWidth)];
+	}
+}
+
+// 3x3 context of quad's pixel (dx, dy) from the 4x4 window
+__attribute__((always_inline))
+void quad_pixel_context(const uint* w, int dx, int dy, uint* v)
+{
+	#pragma unroll
+	for(int y = 0; y < 3; ++y)
+	{
+		#pragma unroll
+		for(int x = 0; x < 3; ++x)
+			v[index2(x, y, 3)] = w[index2(dx + x, dy + y, 4)];
+	}
+}
+
+// invertX/Y select the pattern (as opTrue/opFalse do for other kernels)
+__attribute__((always_inline))
+void convert_bayer_quad2gray(__local const uchar* tile, __write_only image2d_t dst,
+	const int2 size, bool invertX, bool invertY)
+{
+	const int2 pos = { 2 * get_global_id(0), 2 * get_global_id(1) };
+	if(pos.x >= size.x || pos.y >= size.y)
+		return;
+
+	__private uint w[16];
+	__private uint v[9];
+	fetch_quad_context(tile, w);
+
+	#pragma unroll
+	for(int dy = 0; dy < 2; ++dy)
+	{
+		#pragma unroll
+		for(int dx = 0; dx < 2; ++dx)
+		{
+			const int2 gid = pos + (int2)(dx, dy);
+			if(gid.x >= size.x || gid.y >= size.y)
+				continue;
+
+			quad_pixel_context(w, dx, dy, v);
+			uchar3 out = bayer2rgb(v, (dx != 0) != invertX, (dy != 0) != invertY);
+			write_imagef(dst, gid, (float4) (rgb2gray(out) / 255.0f));
+		}
+	}
+}
+
+#define DEFINE_BAYER_KERNEL_GRAY_TILED(name, invertX, invertY) \
+	__kernel void name(__global uchar* src, __write_only image2d_t dst, const int2 size, \
+		__local uchar* tile) \
+	{ \
+		load_bayer_tile(src, tile, size); \
+		convert_bayer_quad2gray(tile, dst, size, invertX, invertY); \
+	}
+
+DEFINE_BAYER_KERNEL_GRAY_TILED(convert_rg2gray_tiled, false, false)
+DEFINE_BAYER_KERNEL_GRAY_TILED(convert_gb2gray_tiled, false, true)
+DEFINE_BAYER_KERNEL_GRAY_TILED(convert_gr2gray_tiled, true,  false)
+DEFINE_BAYER_KERNEL_GRAY_TILED(convert_bg2gray_tiled, true,  true)
+
+//
+// Binned variants: every 2x2 quad becomes one gray pixel (G is the mean of
+// both greens), so output is half of the frame in both dimensions (odd last
+// row/column is dropped). Background subtraction doesn't need full
+// resolution luma and MoG then has 4x less pixels to model.
+//
+
+__attribute__((always_inline))
+uchar bin_bayer_quad2gray(__global const uchar* src, const int2 size, int2 pos,
+	bool invertX, bool invertY)
+{
+	const uchar2 top = vload2(0, src + index2(2 * pos.x, 2 * pos.y, size.x));
+	const uchar2 bottom = vload2(0, src + index2(2 * pos.x, 2 * pos.y + 1, size.x));
+
+	// R is where both coordinates are odd (after inversion), B where none is
+	const uchar2 rowR = invertY ? top : bottom;
+	const uchar2 rowB = invertY ? bottom : top;
+	const uint r = invertX ? rowR.x : rowR.y;
+	const uint b = invertX ? rowB.y : rowB.x;
+	const uint g = ((invertX ? rowR.y : rowR.x) + (invertX ? rowB.x : rowB.y)) >> 1;
+
+	return rgb2gray((uchar3)(r, g, b));
+}
+
+// size is the size of the source (sensor) frame
+#define DEFINE_BAYER_KERNEL_GRAY_BINNED(name, invertX, invertY) \
+	__kernel void name(__global uchar* src, __write_only image2d_t dst, const int2 size) \
+	{ \
+		const int2 gid = { get_global_id(0), get_global_id(1) }; \
+		if(gid.x >= size.x / 2 || gid.y >= size.y / 2) return; \
+		uchar gray = bin_bayer_quad2gray(src, size, gid, invertX, invertY); \
+		write_imagef(dst, gid, (float4) (gray / 255.0f)); \
+	}
+
+DEFINE_BAYER_KERNEL_GRAY_BINNED(convert_rg2gray_binned, false, false)
+DEFINE_BAYER_KERNEL_GRAY_BINNED(convert_gb2gray_binned, false, true)
+DEFINE_BAYER_KERNEL_GRAY_BINNED(convert_gr2gray_binned, true,  false)
+DEFINE_BAYER_KERNEL_GRAY_BINNED(convert_bg2gray_binned, true,  true)
+
+__constant sampler_t nearestSampler = 
+	CLK_NORMALIZED_COORDS_FALSE | 
+	CLK_ADDRESS_CLAMP_TO_EDGE |
+	CLK_FILTER_NEAREST;
+
+// Scales mask of binned frame back to sensor size (nearest neighbour),
+// size is the size of the sensor frame
+__kernel void upscale_binned_mask(__read_only image2d_t src, __write_only image2d_t dst, const int2 size)
+{
+	const int2 gid = { get_global_id(0), get_global_id(1) };
+	if(gid.x >= size.x || gid.y >= size.y)
+		return;
+	write_imagef(dst, gid, read_imagef(src, nearestSampler, gid / 2));
+}
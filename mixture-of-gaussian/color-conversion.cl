@@ -20,55 +20,79 @@ __kernel void rgba2gray(
 	write_imagef(dst, gid, (float4) gray);
 }
 
-__kernel void rgb2gray_image(
-	__global uchar* src,
-	__write_only image2d_t dst,
-	const int2 size)
-{
-	const int2 gid = { get_global_id(0), get_global_id(1) };
-	
-	if(!all(gid < size))
-		return;
-		
-	const int gid1 = gid.x + gid.y * size.x;
-	
-#if __OPENCL_VERSION__ == CL_VERSION_1_0
-	float r = convert_float(src[3*gid1 + 0]);
-	float g = convert_float(src[3*gid1 + 1]);
-	float b = convert_float(src[3*gid1 + 2]);
-	float4 rgba = { r, g, b, 0 };
-	float gray = dot(grayscale, rgba / 255.0f);
+// Same 14-bit fixed point weights and rounding as cv::cvtColor(CV_BGR2GRAY),
+// so gray values are bit-exact with the host path. Source is BGR (as OpenCV
+// delivers it) unless built with -DRGB_ORDER, pixels are either packed 3-byte
+// or padded to 4 bytes (BGRX/BGRA, 4th one is ignored).
+#define GRAY_SHIFT 14
+#define GRAY_G 9617
+#ifdef RGB_ORDER
+#  define GRAY_C0 4899
+#  define GRAY_C2 1868
 #else
-	uchar3 rgb = vload3(gid1, src);
-	float3 rgba = convert_float3(rgb);
-	float gray = dot(grayscale.xyz, rgba / 255.0f);
+#  define GRAY_C0 1868
+#  define GRAY_C2 4899
 #endif
 
-	write_imagef(dst, gid, (float4) gray);
+// c0, c1, c2 - channels in memory order
+__attribute__((always_inline))
+uint4 color2gray4(uint4 c0, uint4 c1, uint4 c2)
+{
+	return (c0 * GRAY_C0 + c1 * GRAY_G + c2 * GRAY_C2 + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT;
 }
 
-__kernel void rgb2gray(
-	__global uchar* src,
-	__global uchar* dst,
-	const int2 size)
+__attribute__((always_inline))
+uint color2gray(uint c0, uint c1, uint c2)
 {
-	const int2 gid = { get_global_id(0), get_global_id(1) };
-	
-	if(!all(gid < size))
-		return;
-		
-	const int gid1 = gid.x + gid.y * size.x;
+	return (c0 * GRAY_C0 + c1 * GRAY_G + c2 * GRAY_C2 + (1 << (GRAY_SHIFT - 1))) >> GRAY_SHIFT;
+}
 
-#if __OPENCL_VERSION__ == CL_VERSION_1_0
-	float r = convert_float(src[3*gid1 + 0]);
-	float g = convert_float(src[3*gid1 + 1]);
-	float b = convert_float(src[3*gid1 + 2]);
-	float4 rgba = { r, g, b, 0 };
-	float gray = dot(grayscale, rgba / 255.0f);
-#else
-	uchar3 rgb = vload3(gid1, src);
-	float3 rgba = convert_float3(rgb);
-	float gray = dot(grayscale.xyz, rgba / 255.0f);
-#endif
-	dst[gid1] = convert_uchar_sat(gray * 255.0f);
-}
\ No newline at end of file
+// 4 packed pixels (12 bytes) starting at pixel index i
+__attribute__((always_inline))
+uint4 load_packed2gray4(__global const uchar* src, int i)
+{
+	const uchar8 lo = vload8(0, src + 3 * i);
+	const uchar4 hi = vload4(2, src + 3 * i);
+	const uint4 c0 = convert_uint4((uchar4)(lo.s0, lo.s3, lo.s6, hi.s1));
+	const uint4 c1 = convert_uint4((uchar4)(lo.s1, lo.s4, lo.s7, hi.s2));
+	const uint4 c2 = convert_uint4((uchar4)(lo.s2, lo.s5, hi.s0, hi.s3));
+	return color2gray4(c0, c1, c2);
+}
+
+// 4 padded pixels (16 bytes) starting at pixel index i,
+// one aligned load when rows are a multiple of 4 pixels
+__attribute__((always_inline))
+uint4 load_padded2gray4(__global const uchar* src, int i)
+{
+	const uchar16 v = vload16(0, src + 4 * i);
+	return color2gray4(convert_uint4(v.s048c), convert_uint4(v.s159d), convert_uint4(v.s26ae));
+}
+
+// Every work-item converts 4 pixels of a row, global size is (width / 4, height)
+// rounded up. Integer values written as n / 255 come back exactly from
+// normalized image (and mog_image scales them by 255).
+#define DEFINE_COLOR2GRAY_IMAGE_KERNEL(name, load4, pixelSize) \
+	__kernel void name(__global const uchar* src, __write_only image2d_t dst, const int2 size) \
+	{ \
+		const int2 gid = { 4 * get_global_id(0), get_global_id(1) }; \
+		if(!all(gid < size)) return; \
+		const int gid1 = gid.x + gid.y * size.x; \
+		if(gid.x + 4 <= size.x) \
+		{ \
+			const float4 gray = convert_float4(load4(src, gid1)) / 255.0f; \
+			write_imagef(dst, gid, (float4) gray.s0); \
+			write_imagef(dst, gid + (int2)(1, 0), (float4) gray.s1); \
+			write_imagef(dst, gid + (int2)(2, 0), (float4) gray.s2); \
+			write_imagef(dst, gid + (int2)(3, 0), (float4) gray.s3); \
+			return; \
+		} \
+		for(int i = 0; gid.x + i < size.x; ++i) \
+		{ \
+			const int j = pixelSize * (gid1 + i); \
+			const uint gray = color2gray(src[j + 0], src[j + 1], src[j + 2]); \
+			write_imagef(dst, gid + (int2)(i, 0), (float4) (gray / 255.0f)); \
+		} \
+	}
+
+DEFINE_COLOR2GRAY_IMAGE_KERNEL(rgb2gray_image,  load_packed2gray4, 3)
+DEFINE_COLOR2GRAY_IMAGE_KERNEL(rgbx2gray_image, load_padded2gray4, 4)
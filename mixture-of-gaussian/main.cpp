@@ -3,12 +3,17 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/video/video.hpp>
 
+#include <chrono>
+#include <csignal>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 
 #include <clw/clw.h>
 
-#include "QPCTimer.h"
+#include "MonotonicClock.h"
 #include "ConfigFile.h"
 #include "FrameGrabber.h"
 
@@ -18,6 +23,14 @@
 
 #include "WorkerCPU.h"
 #include "WorkerGPU.h"
+#include "WorkerHybrid.h"
+#include "StreamRegistry.h"
+#include "ThreadedWorker.h"
+#include "MaskSink.h"
+#include "FrameGovernor.h"
+#include "DeviceScheduler.h"
+#include "TraceRecorder.h"
+#include "WorkGroupTuner.h"
 
 namespace clwutils
 {
@@ -93,116 +106,300 @@ namespace clwutils
 
 		return devices;
 	}
+
+	// Every device of every platform (e.g. CPU runtimes of several vendors and iGPU)
+	std::vector<clw::Device> allDevices()
+	{
+		std::vector<clw::Device> all;
+		std::vector<clw::Platform> platforms = clw::availablePlatforms();
+		for(auto& platform : platforms)
+		{
+			std::vector<clw::Device> devices = clw::devices(clw::All, platform);
+			all.insert(all.end(), devices.begin(), devices.end());
+		}
+		return all;
+	}
 }
 
-void mainCPU(ConfigFile& cfg)
+namespace streams
 {
-	int numVideoStreams = 0;
+	const char* configFileName = "mixture-of-gaussian.cfg";
 
-	std::vector<bool> finish;
-	std::vector<std::unique_ptr<WorkerCPU>> workers;
-	std::vector<std::string> titles;
+	// Reloads configuration and starts/stops streams accordingly.
+	// Returns sources of removed streams.
+	template<typename Worker>
+	std::vector<std::string> reload(ConfigFile& cfg, StreamRegistry<Worker>& registry, bool headless)
+	{
+		ConfigFile fresh;
+		if(!fresh.load(configFileName))
+			return std::vector<std::string>();
+		cfg.swap(fresh);
+
+		std::vector<std::string> removed = registry.sync();
+		if(headless)
+			return removed;
+		for(auto& title : removed)
+		{
+			cv::destroyWindow(title);
+			cv::destroyWindow(title + " source");
+			cv::destroyWindow(title + " intermediate frame");
+		}
+		return removed;
+	}
 
-	for(int streamId = 1; streamId <= 5; ++streamId)
+	double reloadInterval(ConfigFile& cfg)
 	{
-		std::string cfgVideoStream = "VideoStream";
-		cfgVideoStream += streamId + '0';
-		std::string videoStream = cfg.value(cfgVideoStream, "General");
+		if(!cfg.exists("StreamReloadInterval", "General"))
+			return 0;
+		return std::stod(cfg.value("StreamReloadInterval", "General"));
+	}
 
-		if(!videoStream.empty())
+	// Time between consecutive frames [ms]. Headless mode has its own
+	// setting where 0 means as fast as frames arrive.
+	int frameInterval(ConfigFile& cfg, bool headless)
+	{
+		if(headless)
 		{
-			auto worker = std::unique_ptr<WorkerCPU>(new WorkerCPU(cfg));
-			if(!worker->init(videoStream))
-				continue;
+			if(!cfg.exists("FrameInterval", "Headless"))
+				return 0;
+			return std::max(std::stoi(cfg.value("FrameInterval", "Headless")), 0);
+		}
+
+		int frameInterval = std::stoi(cfg.value("FrameInterval", "General"));
+		return std::min(std::max(frameInterval, 1), 100);
+	}
+
+	// How often to print per-stream statistics [s], 0 - never
+	double statsInterval(ConfigFile& cfg)
+	{
+		if(!cfg.exists("StatsInterval", "General"))
+			return 0;
+		return std::stod(cfg.value("StatsInterval", "General"));
+	}
+
+	void printStats(const std::string& title, FrameGovernor& governor)
+	{
+		FrameGovernor::Stats stats = governor.collectStats();
+		std::cout << title << ": " << stats.fps << " fps, processed: " << stats.processed
+			<< ", dropped: " << stats.dropped << ", late: " << stats.deadlineMisses;
+		if(stats.stride > 1)
+			std::cout << ", model updated every " << stats.stride << " frames";
+		std::cout << "\n  latency p50: " << stats.latencyP50 << " ms, p90: " << stats.latencyP90
+			<< " ms, p99: " << stats.latencyP99 << " ms, p999: " << stats.latencyP999
+			<< " ms, max: " << stats.latencyMax << " ms\n";
+		std::cout << "  processing p50: " << stats.processingP50 << " ms, p99: " << stats.processingP99
+			<< " ms, p999: " << stats.processingP999 << " ms\n";
+	}
+}
+
+namespace shutdown
+{
+	// Set on SIGINT/SIGTERM, main loops finish current frame and return
+	volatile std::sig_atomic_t requested = 0;
+
+	void onSignal(int)
+	{
+		requested = 1;
+	}
+
+	void install()
+	{
+		std::signal(SIGINT, onSignal);
+		std::signal(SIGTERM, onSignal);
+	}
+}
+
+namespace tracing
+{
+	// Empty - tracing disabled
+	std::string fileName;
+	// Set on SIGUSR1, main loops write trace recorded so far
+	volatile std::sig_atomic_t dumpRequested = 0;
+
+	void onDumpSignal(int)
+	{
+		dumpRequested = 1;
+	}
 
-			workers.emplace_back(std::move(worker));
-			titles.emplace_back(std::move(videoStream));
-			finish.push_back(false);
+	void init(ConfigFile& cfg)
+	{
+		if(cfg.exists("TraceFile", "General"))
+			fileName = cfg.value("TraceFile", "General");
+		if(fileName.empty())
+			return;
+
+		size_t bufferSize = 1 << 15;
+		if(cfg.exists("TraceBufferSize", "General"))
+			bufferSize = std::stoul(cfg.value("TraceBufferSize", "General"));
+
+		TraceRecorder::enable(bufferSize);
+		TraceRecorder::setThreadName("main");
+		std::cout << "Recording trace to " << fileName << "\n";
+#if defined(SIGUSR1)
+		std::signal(SIGUSR1, onDumpSignal);
+#endif
+	}
 
-			++numVideoStreams;
+	void dumpIfRequested()
+	{
+		if(!dumpRequested)
+			return;
+		dumpRequested = 0;
+		TraceRecorder::dump(fileName);
+	}
+
+	// Places commands of the last frame on the stream's device track. Device clock
+	// has its own epoch, first command is assumed to be queued at enqueueTime.
+	void recordDeviceFrame(const char* track, const StageProfiler& profiler, int64_t enqueueTime)
+	{
+		const std::vector<StageProfiler::CommandTiming>& commands = profiler.lastFrame();
+		if(commands.empty())
+			return;
+
+		const int64_t offset = enqueueTime - int64_t(commands[0].queued);
+		for(auto& command : commands)
+		{
+			TraceRecorder::recordDevice(track, stageName(command.stage), nullptr,
+				int64_t(command.started) + offset, int64_t(command.finished) + offset);
 		}
 	}
+}
 
-	if(numVideoStreams < 1)
+// Every stream runs on its own thread, main thread displays results
+template<typename Worker>
+void mainThreaded(ConfigFile& cfg, bool headless, 
+	const std::function<Worker*(const StreamConfig&)>& createWorker)
+{
+	typedef ThreadedWorker<Worker> StreamWorker;
+
+	int frameInterval = streams::frameInterval(cfg, headless);
+	bool showSourceFrame = !headless && cfg.value("ShowSourceFrame", "General") == "yes";
+	bool showIntermediateFrame = !headless && cfg.value("ShowIntermediateFrame", "General") == "yes";
+	double reloadInterval = streams::reloadInterval(cfg);
+	double statsInterval = streams::statsInterval(cfg);
+
+	// Every stream grabs and processes frames on its own thread,
+	// this one only displays the latest results (or hands them to the sink)
+	StreamRegistry<StreamWorker> registry(cfg, 
+		[&](const StreamConfig& streamCfg) 
+		{
+			return new StreamWorker(createWorker(streamCfg), 
+				createFrameGovernor(streamCfg, frameInterval),
+				showSourceFrame, showIntermediateFrame);
+		});
+	registry.sync();
+
+	if(registry.empty())
 	{
 		std::wcout << "No video stream to process\n";
-		std::cin.get();
+		if(!headless)
+			std::cin.get();
 		std::exit(-1);
 	}
 
-	QPCTimer timer;
+	std::unique_ptr<MaskSink> sink;
+	if(headless)
+		sink = createMaskSink(cfg);
 
-	int frameInterval = std::stoi(cfg.value("FrameInterval", "General"));
-	frameInterval = std::min(std::max(frameInterval, 1), 100);
-	bool showSourceFrame = cfg.value("ShowSourceFrame", "General") == "yes";
-	bool showIntermediateFrame = cfg.value("ShowIntermediateFrame", "General") == "yes";
 	std::cout << "\n";
 
-	double start = timer.currentTime();
+	double lastReload = MonotonicClock::seconds();
+	double lastStats = lastReload;
+	typename StreamWorker::Output output;
 
-	for(;;)
+	while(!shutdown::requested)
 	{
-		double oldStart = start;
-		start = timer.currentTime();
-
-		std::cout << "Time between consecutive frames: " << (start - oldStart) * 1000.0 << " ms\n";
+		tracing::dumpIfRequested();
 
-		// Grab a new frame
-		for(int i = 0; i < numVideoStreams; ++i)
-			finish[i] = workers[i]->grabFrame();
-
-		bool allFinish = false;
-		for(int i = 0; i < numVideoStreams; ++i)
-			allFinish = allFinish || finish[i];
-		if(!allFinish)
-			break;
+		double now = MonotonicClock::seconds();
+		if(reloadInterval > 0 && now - lastReload >= reloadInterval)
+		{
+			streams::reload(cfg, registry, headless);
+			lastReload = now;
+		}
 
-		start = timer.currentTime();
+		if(statsInterval > 0 && now - lastStats >= statsInterval)
+		{
+			for(size_t i = 0; i < registry.size(); ++i)
+				streams::printStats(registry[i].source, registry[i].worker->governor());
+			lastStats = now;
+		}
 
-		for(int i = 0; i < numVideoStreams; ++i)
+		bool allFinished = true;
+		bool anyOutput = false;
+		for(size_t i = 0; i < registry.size(); ++i)
 		{
-			if(finish[i])
+			StreamWorker& worker = *registry[i].worker;
+			const std::string& title = registry[i].source;
+
+			if(worker.latestOutput(&output))
 			{
-				workers[i]->processFrame();
+				anyOutput = true;
+
+				if(headless)
+				{
+					TraceSpan span("sink", registry[i].traceName);
+					sink->consume(title, output.frameNumber, output.finalFrame);
+				}
+				else
+				{
+					TraceSpan span("display", registry[i].traceName);
+					if(!TraceRecorder::enabled())
+					{
+						std::cout << title << ": frame " << output.frameNumber 
+							<< ", processing time: " << output.processingTime << " ms\n";
+					}
+
+					cv::imshow(title, output.finalFrame);
+					if(showSourceFrame)
+						cv::imshow(title + " source", output.sourceFrame);
+					if(showIntermediateFrame && !output.intermediateFrame.empty())
+						cv::imshow(title + " intermediate frame", output.intermediateFrame);
+				}
 			}
-		}
 
-		double stop = timer.currentTime();
+			allFinished = allFinished && worker.isFinished();
+		}
 
-		std::cout << "Total processing and transfer time: " << (stop - start) * 1000.0 << " ms\n\n";
+		if(allFinished)
+			break;
 
-		for(int i = 0; i < numVideoStreams; ++i)
+		if(headless)
 		{
-			cv::imshow(titles[i], workers[i]->finalFrame());
-			if(showSourceFrame)
-				cv::imshow(titles[i] + " source", workers[i]->sourceFrame());
-			if(showIntermediateFrame)
-				cv::imshow(titles[i] + " intermediate frame", workers[i]->intermediateFrame());
+			// Workers set the pace, just don't spin when there's nothing new
+			if(!anyOutput)
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			continue;
 		}
 
-		int time = int((stop - start) * 1000);
-		int delay = std::max(1, frameInterval - time);
-
-		int key = cv::waitKey(delay);
+		int key = cv::waitKey(frameInterval);
 		if(key >= 0)
 			break;
 	}
+
+	// Workers' threads are stopped by registry
 }
 
-void mainGPU(ConfigFile& cfg)
+void mainCPU(ConfigFile& cfg, bool headless)
 {
-	std::string devpick = cfg.value("Device", "General");
+	mainThreaded<WorkerCPU>(cfg, headless, 
+		[](const StreamConfig& streamCfg) { return new WorkerCPU(streamCfg); });
+}
 
-	// Initialize OpenCL
-	clw::Context context;
+// Adds devices selected by Device key
+void addDevices(ConfigFile& cfg, DeviceScheduler& scheduler)
+{
+	std::string devpick = cfg.value("Device", "General");
 
 	if(devpick == "pick")
 	{
-		if(!context.create(clwutils::pickSingleDevice()))
-		{
-			std::cerr << "Couldn't create context, quitting\n";
-			std::exit(-1);
-		}
+		scheduler.addDevice(clwutils::pickSingleDevice()[0]);
+	}
+	else if(devpick == "all")
+	{
+		std::vector<clw::Device> devices = clwutils::allDevices();
+		for(auto& device : devices)
+			scheduler.addDevice(device);
 	}
 	else
 	{
@@ -211,133 +408,298 @@ void mainGPU(ConfigFile& cfg)
 			type = clw::Gpu;
 		else if(devpick == "cpu")
 			type = clw::Cpu;
-		if(!context.create(type))
-		{
-			std::cerr << "Couldn't create context, quitting\n";
-			std::exit(-1);
-		}
+
+		clw::Context context;
+		if(context.create(type))
+			scheduler.addDevice(context, context.devices()[0]);
 	}
-	clw::Device device = context.devices()[0];
-	clw::CommandQueue queue = context.createCommandQueue
-		(clw::Property_ProfilingEnabled, device);
 
-	int numVideoStreams = 0;
+	if(scheduler.numDevices() == 0)
+	{
+		std::cerr << "Couldn't create context, quitting\n";
+		std::exit(-1);
+	}
+}
 
-	std::vector<bool> finish;
-	std::vector<std::unique_ptr<WorkerGPU>> workers;
-	std::vector<std::string> titles;
+void mainHybrid(ConfigFile& cfg, bool headless)
+{
+	// Streams are spread over devices but never moved, 
+	// each one balances its rows between its device and host itself
+	DeviceScheduler scheduler;
+	addDevices(cfg, scheduler);
+	std::unique_ptr<WorkGroupTuner> tuner = createWorkGroupTuner(cfg);
+
+	mainThreaded<WorkerHybrid>(cfg, headless, 
+		[&](const StreamConfig& streamCfg)
+		{
+			DeviceScheduler::Slot& slot = scheduler.slot(scheduler.assign(streamCfg.streamSection()));
+			return new WorkerHybrid(slot.context, slot.device, streamCfg, tuner.get());
+		});
+}
 
-	for(int streamId = 1; streamId <= 5; ++streamId)
-	{
-		std::string cfgVideoStream = "VideoStream";
-		cfgVideoStream += streamId + '0';
-		std::string videoStream = cfg.value(cfgVideoStream, "General");
+void mainGPU(ConfigFile& cfg, bool headless)
+{
+	// Initialize OpenCL
+	DeviceScheduler scheduler;
+	addDevices(cfg, scheduler);
+	std::unique_ptr<WorkGroupTuner> tuner = createWorkGroupTuner(cfg);
 
-		if(!videoStream.empty())
+	StreamRegistry<WorkerGPU> registry(cfg, 
+		[&](const StreamConfig& streamCfg)
 		{
-			auto worker = std::unique_ptr<WorkerGPU>(new WorkerGPU(context ,device, queue, cfg));
-			if(!worker->init(videoStream))
-				continue;
+			DeviceScheduler::Slot& slot = scheduler.slot(scheduler.assign(streamCfg.streamSection()));
+			return new WorkerGPU(slot.context, slot.device, streamCfg, tuner.get());
+		});
 
-			workers.emplace_back(std::move(worker));
-			titles.emplace_back(std::move(videoStream));
-			finish.push_back(false);
+	auto syncScheduler = [&]
+	{
+		std::vector<std::string> running;
+		for(size_t i = 0; i < registry.size(); ++i)
+			running.push_back(registry[i].id);
+		scheduler.retainStreams(running);
+	};
 
-			++numVideoStreams;
-		}
-	}
+	registry.sync();
+	syncScheduler();
 
-	if(numVideoStreams < 1)
+	if(registry.empty())
 	{
 		std::wcout << "No video stream to process\n";
-		std::cin.get();
+		if(!headless)
+			std::cin.get();
 		std::exit(-1);
 	}
 
-	QPCTimer timer;
-
-	int frameInterval = std::stoi(cfg.value("FrameInterval", "General"));
-	frameInterval = std::min(std::max(frameInterval, 1), 100);
+	int frameInterval = streams::frameInterval(cfg, headless);
 	bool showSourceFrame = cfg.value("ShowSourceFrame", "General") == "yes";
 	bool showIntermediateFrame = cfg.value("ShowIntermediateFrame", "General") == "yes";
+	double reloadInterval = streams::reloadInterval(cfg);
+	double statsInterval = streams::statsInterval(cfg);
+	double rebalanceInterval = 5.0;
+	if(cfg.exists("RebalanceInterval", "General"))
+		rebalanceInterval = std::stod(cfg.value("RebalanceInterval", "General"));
 	std::cout << "\n";
 
-	double start = timer.currentTime();
+	std::unique_ptr<MaskSink> sink;
+	if(headless)
+		sink = createMaskSink(cfg);
+
+	double start = MonotonicClock::seconds();
+	double lastReload = start;
+	double lastStats = start;
+	double lastRebalance = start;
 
-	std::vector<clw::EventList> eventLists(numVideoStreams);
+	std::vector<char> admitted;
+	std::vector<int64_t> enqueueTimes;
+	// Pacing and frame dropping per stream (keyed by source)
+	std::unordered_map<std::string, std::unique_ptr<FrameGovernor>> governors;
 
-	for(;;)
+	while(!shutdown::requested)
 	{
+		tracing::dumpIfRequested();
+
 		double oldStart = start;
-		start = timer.currentTime();
+		start = MonotonicClock::seconds();
+
+		if(!headless && !TraceRecorder::enabled())
+			std::cout << "Time between consecutive frames: " << (start - oldStart) * 1000.0 << " ms\n";
+
+		if(reloadInterval > 0 && start - lastReload >= reloadInterval)
+		{
+			std::vector<std::string> removed = streams::reload(cfg, registry, headless);
+			for(auto& source : removed)
+				governors.erase(source);
+			syncScheduler();
+			lastReload = start;
+		}
+
+		// Move a stream off a saturated device. Without frame interval
+		// (headless, frames taken as they arrive) there's no frame budget
+		// to be saturated against, so streams stay where they are.
+		std::string movedStream;
+		size_t target;
+		if(rebalanceInterval > 0 && frameInterval > 0 &&
+			start - lastRebalance >= rebalanceInterval && 
+			scheduler.rebalance(frameInterval, &movedStream, &target))
+		{
+			for(size_t i = 0; i < registry.size(); ++i)
+			{
+				if(registry[i].id != movedStream)
+					continue;
+
+				DeviceScheduler::Slot& slot = scheduler.slot(target);
+				std::unique_ptr<WorkerGPU> worker(new WorkerGPU(
+					slot.context, slot.device, StreamConfig(cfg, movedStream), tuner.get()));
+				if(worker->migrateFrom(*registry[i].worker))
+				{
+					std::cout << "Moving " << registry[i].source << " to " << slot.device.name() << "\n";
+					registry[i].worker = std::move(worker);
+					scheduler.moved(movedStream, target);
+				}
+			}
+			lastRebalance = start;
+		}
 
-		std::cout << "Time between consecutive frames: " << (start - oldStart) * 1000.0 << " ms\n";
+		for(size_t i = 0; i < registry.size(); ++i)
+		{
+			auto& governor = governors[registry[i].source];
+			if(!governor)
+				governor = createFrameGovernor(StreamConfig(cfg, registry[i].id), frameInterval);
+		}
 
-		// Grab a new frame
-		for(int i = 0; i < numVideoStreams; ++i)
-			finish[i] = workers[i]->grabFrame();
+		if(statsInterval > 0 && start - lastStats >= statsInterval)
+		{
+			for(size_t i = 0; i < registry.size(); ++i)
+			{
+				streams::printStats(registry[i].source, *governors[registry[i].source]);
+				registry[i].worker->profiler().report(std::cout, registry[i].source);
+			}
+
+			std::vector<double> loads = scheduler.deviceLoads();
+			for(size_t d = 0; d < loads.size(); ++d)
+				std::cout << scheduler.slot(d).device.name() << ": " << loads[d] << " ms per frame\n";
+			lastStats = start;
+		}
 
-		bool allFinish = false;
-		for(int i = 0; i < numVideoStreams; ++i)
-			allFinish = allFinish || finish[i];
-		if(!allFinish)
+		// Grab a new frame, skip processing of stale ones
+		bool anyGrabbed = false;
+		admitted.assign(registry.size(), 0);
+		for(size_t i = 0; i < registry.size(); ++i)
+		{
+			TraceSpan span("grab", registry[i].traceName);
+			registry[i].grabbed = registry[i].worker->grabFrame();
+			anyGrabbed = anyGrabbed || registry[i].grabbed;
+			if(registry[i].grabbed)
+			{
+				admitted[i] = governors[registry[i].source]->admit();
+				if(!admitted[i])
+					++registry[i].frameNumber;
+			}
+		}
+		if(!anyGrabbed)
 			break;
 
-		start = timer.currentTime();
+		start = MonotonicClock::seconds();
 
-		for(int i = 0; i < numVideoStreams; ++i)
+		enqueueTimes.assign(registry.size(), 0);
+		for(size_t i = 0; i < registry.size(); ++i)
 		{
-			if(finish[i])
+			if(admitted[i])
 			{
-				eventLists[i] = workers[i]->processFrame();
-				queue.flush();
+				TraceSpan span("enqueue", registry[i].traceName);
+				enqueueTimes[i] = TraceRecorder::now();
+				registry[i].worker->processFrame();
+				registry[i].worker->commandQueue().flush();
+			}
+		}
+		// Streams' queues run concurrently, wait for all of them
+		{
+			TraceSpan span("finish");
+			for(size_t i = 0; i < registry.size(); ++i)
+			{
+				if(admitted[i])
+					registry[i].worker->commandQueue().finish();
 			}
 		}
-		queue.finish();
 
-		double stop = timer.currentTime();
+		double stop = MonotonicClock::seconds();
 		double mogProcessingTime = 0;
 
-		for(int i = 0; i < numVideoStreams; ++i)
+		for(size_t i = 0; i < registry.size(); ++i)
+		{
+			if(!admitted[i])
+				continue;
+			governors[registry[i].source]->completed();
+
+			StageProfiler& profiler = registry[i].worker->profiler();
+			profiler.frameFinished();
+			mogProcessingTime += profiler.lastStageTime(Stage_MoG);
+
+			// Device time of the whole frame drives stream placement
+			scheduler.reportCost(registry[i].id, profiler.lastDeviceTime());
+
+			if(TraceRecorder::enabled())
+				tracing::recordDeviceFrame(registry[i].worker->deviceTrack(), profiler, enqueueTimes[i]);
+		}
+
+		// Wait until the earliest stream is due for its next frame
+		auto now = FrameGovernor::clock::now();
+		auto due = now + std::chrono::milliseconds(frameInterval);
+		for(size_t i = 0; i < registry.size(); ++i)
+			due = std::min(due, governors[registry[i].source]->nextFrameDue());
+		int delay = int(std::chrono::duration_cast<std::chrono::milliseconds>(due - now).count());
+
+		if(headless)
 		{
-			const auto& event = eventLists[i].at(0);
-			mogProcessingTime += (event.finishTime() - event.startTime()) * 1e-6;
+			for(size_t i = 0; i < registry.size(); ++i)
+			{
+				if(!admitted[i])
+					continue;
+				TraceSpan span("sink", registry[i].traceName);
+				sink->consume(registry[i].source, registry[i].frameNumber++, 
+					registry[i].worker->finalFrame());
+			}
+
+			if(delay > 0)
+				std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+			continue;
 		}
 
-		std::cout << "Total processing and transfer time: " << 
-			(stop - start) * 1000.0 << " ms\n";
-		std::cout << "MoG processing time: " << mogProcessingTime << " ms\n\n";
+		if(!TraceRecorder::enabled())
+		{
+			std::cout << "Total processing and transfer time: " << 
+				(stop - start) * 1000.0 << " ms\n";
+			std::cout << "MoG processing time: " << mogProcessingTime << " ms\n\n";
+		}
 
-		for(int i = 0; i < numVideoStreams; ++i)
+		for(size_t i = 0; i < registry.size(); ++i)
 		{
-			cv::imshow(titles[i], workers[i]->finalFrame());
+			const std::string& title = registry[i].source;
+			WorkerGPU& worker = *registry[i].worker;
+			TraceSpan span("display", registry[i].traceName);
+
+			cv::imshow(title, worker.finalFrame());
 			if(showSourceFrame)
-				cv::imshow(titles[i] + " source", workers[i]->sourceFrame());
+				cv::imshow(title + " source", worker.sourceFrame());
 			if(showIntermediateFrame)
-				cv::imshow(titles[i] + " intermediate frame", workers[i]->intermediateFrame());
+				cv::imshow(title + " intermediate frame", worker.intermediateFrame());
 		}
 
-		int time = int((stop - start) * 1000);
-		int delay = std::max(1, frameInterval - time);
-
-		int key = cv::waitKey(delay);
+		int key = cv::waitKey(std::max(1, delay));
 		if(key >= 0)
 			break;
 	}
 }
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
 	ConfigFile cfg;
-	if(!cfg.load("mixture-of-gaussian.cfg"))
+	if(!cfg.load(streams::configFileName))
 	{
 		std::cerr << "Can't load mixture-of-gaussian.cfg, qutting\n";
 		std::cin.get();
 		exit(-1);
 	}
 
-	if(cfg.value("OpenCL", "General") == "yes")
-		mainGPU(cfg);
+	// Headless mode: no HighGUI windows, masks go to configured sink
+	bool headless = cfg.value("Headless", "General") == "yes";
+	for(int i = 1; i < argc; ++i)
+	{
+		if(std::string(argv[i]) == "--headless")
+			headless = true;
+	}
+
+	shutdown::install();
+	tracing::init(cfg);
+
+	std::string mode = cfg.value("OpenCL", "General");
+	if(mode == "yes")
+		mainGPU(cfg, headless);
+	else if(mode == "hybrid")
+		mainHybrid(cfg, headless);
 	else
-		mainCPU(cfg);
+		mainCPU(cfg, headless);
+
+	if(TraceRecorder::enabled())
+		TraceRecorder::dump(tracing::fileName);
 }
@@ -16,22 +16,21 @@ typedef struct MogParams
 #define nmixtures 5
 #endif
 
-__kernel void mog_image(
-	__read_only image2d_t frame,
-	__write_only image2d_t dst,
+// 255.0f for UNORM_INT8 input, 65535.0f for UNORM_INT16 input
+#ifndef PIXEL_SCALE
+#define PIXEL_SCALE 255.0f
+#endif
+
+// Updates mixtures of one pixel, kept at index gid1 of planes of size1 values,
+// returns 1.0f for foreground and 0.0f for background
+float mog_pixel(
+	float pix,
 	__global float* mixtureData,
+	const int gid1,
+	const int size1,
 	__constant MogParams* params,
 	const float alpha) // krzywa uczenia
 {
-	const int2 gid = { get_global_id(0), get_global_id(1) };
-	const int2 size = { get_image_width(frame), get_image_height(frame) };
-	
-	if (!all(gid < size))
-		return;
-		
-	float pix = read_imagef(frame, smp, gid).x * 255.0f;
-	const int gid1 = gid.x + gid.y * size.x;
-	const int size1 = size.x * size.y;
 	int pdfMatched = -1;
 
 	__private float weight[nmixtures];
@@ -80,8 +79,14 @@ __kernel void mog_image(
 			{
 				float diff = pix - mean[mx];
 
+#ifdef HOST_UPDATE_RULE
+				// Same update as MixtureOfGaussianCPU, hybrid worker splits
+				// frames between both and moves mixtures across
+				float rho = alpha;
+#else
 				#define PI_MULT_2 6.28318530717958647692f
 				float rho = alpha / native_sqrt(PI_MULT_2 * var[mx]) * native_exp(-0.5f * diff*diff / var[mx]);
+#endif
 
 				weight[mx] = weight[mx] + alpha * (1 - weight[mx]);
 				mean[mx] = mean[mx] + rho * diff;
@@ -147,11 +152,7 @@ __kernel void mog_image(
 	// No match is found with any of the K Gaussians.
 	// In this case, the pixel is classified as foreground
 	if(pdfMatched < 0)
-	{
-		float pix = 1.0f;
-		write_imagef(dst, gid, (float4) pix);
-		return;
-	}
+		return 1.0f;
 
 	// If the Gaussian distribution is classified as a background one,
 	// the pixel is classified as background,
@@ -169,11 +170,53 @@ __kernel void mog_image(
 
 		if(weightSum > params->backgroundRatio)
 		{
-			float pix = pdfMatched > mx 
+			return pdfMatched > mx 
 				? 1.0f // foreground
 				: 0.0f;  // background
-			write_imagef(dst, gid, (float4) pix);
-			return;
 		}
 	}
+	return 0.0f;
+}
+
+__kernel void mog_image(
+	__read_only image2d_t frame,
+	__write_only image2d_t dst,
+	__global float* mixtureData,
+	__constant MogParams* params,
+	const float alpha) // krzywa uczenia
+{
+	const int2 gid = { get_global_id(0), get_global_id(1) };
+	const int2 size = { get_image_width(frame), get_image_height(frame) };
+	
+	if (!all(gid < size))
+		return;
+		
+	float pix = read_imagef(frame, smp, gid).x * PIXEL_SCALE;
+	float fg = mog_pixel(pix, mixtureData, gid.x + gid.y * size.x, size.x * size.y, params, alpha);
+	write_imagef(dst, gid, (float4) fg);
+}
+
+// Models only pixels of region of interest: i-th work-item takes pixel
+// indices[i] and keeps its mixtures at index i (planes of numPixels values).
+// count - number of work-items doing something (first rows only in hybrid mode)
+__kernel void mog_roi(
+	__read_only image2d_t frame,
+	__write_only image2d_t dst,
+	__global float* mixtureData,
+	__constant MogParams* params,
+	const float alpha,
+	__global const int* indices,
+	const int count,
+	const int numPixels)
+{
+	const int i = get_global_id(0);
+	if(i >= count)
+		return;
+
+	const int width = get_image_width(frame);
+	const int2 gid = { indices[i] % width, indices[i] / width };
+
+	float pix = read_imagef(frame, smp, gid).x * PIXEL_SCALE;
+	float fg = mog_pixel(pix, mixtureData, i, numPixels, params, alpha);
+	write_imagef(dst, gid, (float4) fg);
 }
\ No newline at end of file
@@ -0,0 +1,532 @@
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/video/video.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <clw/clw.h>
+
+#include "MixtureOfGaussianCPU.h"
+#include "MixtureOfGaussianGPU.h"
+#include "MonotonicClock.h"
+
+//
+// Throughput of MoG engines on the same frames: native CPU implementation
+// (for every thread count), OpenCV's BackgroundSubtractorMOG and the OpenCL
+// kernel (by default on a CPU OpenCL runtime). Frames are synthetic or taken
+// from a recording and are kept in memory, so decoding isn't measured.
+// Results go to stdout as CSV or JSON lines, progress to stderr.
+//
+// mog-bench [--video file] [--frames N] [--warmup N] [--sizes 640x480,1920x1080]
+//           [--mixtures 3,5] [--threads 1,2,4] [--opencl cpu|gpu|default|none]
+//           [--workgroup 16x16] [--format csv|json]
+//
+
+namespace
+{
+	// MoG parameters, the same as defaults in mixture-of-gaussian.cfg
+	const int history = 200;
+	const float learningRate = -1.0f;
+	const float backgroundRatio = 0.7f;
+	const float varianceThreshold = 6.25f;
+	const float initialWeight = 0.05f;
+	const float initialVariance = 500.0f;
+	const float minVariance = 0.4f;
+
+	// Mask agreement is measured over that many last frames
+	const int agreementFrames = 16;
+
+	struct Options
+	{
+		std::string video;
+		int numFrames;
+		int warmupFrames;
+		std::vector<cv::Size> sizes;
+		std::vector<int> mixtures;
+		std::vector<int> threads;
+		std::string opencl;
+		int workGroupSizeX;
+		int workGroupSizeY;
+		bool json;
+	};
+
+	struct Result
+	{
+		std::string engine;
+		cv::Size size;
+		int mixtures;
+		int threads;             // 0 - engine decides
+		int frames;              // timed frames
+		double seconds;
+		double deviceMs;         // kernel time per frame, OpenCL only
+		double modelBytes;       // memory traffic per frame (model, frame, mask)
+		double transferBytes;    // host <-> device per frame
+		double agreement;        // fraction of mask pixels equal to reference
+	};
+
+	std::vector<std::string> split(const std::string& str, char delim)
+	{
+		std::vector<std::string> items;
+		std::istringstream strm(str);
+		std::string item;
+		while(std::getline(strm, item, delim))
+		{
+			if(!item.empty())
+				items.push_back(item);
+		}
+		return items;
+	}
+
+	bool parseSize(const std::string& str, int* width, int* height)
+	{
+		std::vector<std::string> dims = split(str, 'x');
+		if(dims.size() != 2)
+			return false;
+		*width = std::atoi(dims[0].c_str());
+		*height = std::atoi(dims[1].c_str());
+		return *width > 0 && *height > 0;
+	}
+
+	bool parseOptions(int argc, char** argv, Options* opts)
+	{
+		opts->numFrames = 200;
+		opts->warmupFrames = 10;
+		opts->sizes.push_back(cv::Size(640, 480));
+		opts->sizes.push_back(cv::Size(1280, 720));
+		opts->sizes.push_back(cv::Size(1920, 1080));
+		opts->mixtures.push_back(3);
+		opts->mixtures.push_back(5);
+		const int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+		for(int n = 1; n < maxThreads; n *= 2)
+			opts->threads.push_back(n);
+		opts->threads.push_back(maxThreads);
+		opts->opencl = "cpu";
+		opts->workGroupSizeX = 16;
+		opts->workGroupSizeY = 16;
+		opts->json = false;
+
+		for(int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if(i + 1 >= argc)
+			{
+				std::cerr << "Missing value of " << arg << "\n";
+				return false;
+			}
+			std::string value = argv[++i];
+
+			if(arg == "--video")
+			{
+				opts->video = value;
+			}
+			else if(arg == "--frames")
+			{
+				opts->numFrames = std::atoi(value.c_str());
+			}
+			else if(arg == "--warmup")
+			{
+				opts->warmupFrames = std::max(std::atoi(value.c_str()), 0);
+			}
+			else if(arg == "--sizes")
+			{
+				opts->sizes.clear();
+				for(auto& item : split(value, ','))
+				{
+					int width, height;
+					if(!parseSize(item, &width, &height))
+					{
+						std::cerr << "Wrong size " << item << ", expected WIDTHxHEIGHT\n";
+						return false;
+					}
+					opts->sizes.push_back(cv::Size(width, height));
+				}
+			}
+			else if(arg == "--mixtures" || arg == "--threads")
+			{
+				std::vector<int>& list = arg == "--mixtures" ? opts->mixtures : opts->threads;
+				list.clear();
+				for(auto& item : split(value, ','))
+					list.push_back(std::max(std::atoi(item.c_str()), 1));
+			}
+			else if(arg == "--opencl")
+			{
+				opts->opencl = value;
+			}
+			else if(arg == "--workgroup")
+			{
+				if(!parseSize(value, &opts->workGroupSizeX, &opts->workGroupSizeY))
+				{
+					std::cerr << "Wrong work-group size " << value << ", expected XxY\n";
+					return false;
+				}
+			}
+			else if(arg == "--format")
+			{
+				opts->json = value == "json";
+			}
+			else
+			{
+				std::cerr << "Unknown option " << arg << "\n";
+				return false;
+			}
+		}
+
+		if(opts->numFrames <= opts->warmupFrames)
+		{
+			std::cerr << "Number of frames must be greater than number of warm-up frames\n";
+			return false;
+		}
+		return !opts->sizes.empty() && !opts->mixtures.empty() && !opts->threads.empty();
+	}
+
+	// Textured static background with noise, a few moving objects
+	// and a global illumination drift
+	std::vector<cv::Mat> syntheticFrames(cv::Size size, int numFrames)
+	{
+		cv::RNG rng(0x6d6f67);
+		cv::Mat background(size, CV_8UC1);
+		rng.fill(background, cv::RNG::UNIFORM, 40, 200);
+		cv::GaussianBlur(background, background, cv::Size(7, 7), 0);
+
+		std::vector<cv::Mat> frames;
+		cv::Mat noise(size, CV_16SC1);
+		for(int i = 0; i < numFrames; ++i)
+		{
+			cv::Mat frame;
+			background.convertTo(frame, CV_8U, 1.0, 10.0 * std::sin(i * 0.01));
+
+			const int objWidth = std::max(size.width / 10, 4);
+			const int objHeight = std::max(size.height / 8, 4);
+			cv::rectangle(frame,
+				cv::Rect((i * 7) % size.width, size.height / 4, objWidth, objHeight),
+				cv::Scalar(250), -1);
+			cv::circle(frame,
+				cv::Point(size.width - (i * 5) % size.width, size.height * 2 / 3),
+				objHeight / 2, cv::Scalar(15), -1);
+
+			rng.fill(noise, cv::RNG::NORMAL, 0, 4);
+			cv::Mat noisy;
+			cv::add(frame, noise, noisy, cv::noArray(), CV_8U);
+			frames.push_back(noisy);
+		}
+		return frames;
+	}
+
+	bool recordedFrames(const std::string& video, int numFrames, std::vector<cv::Mat>* frames)
+	{
+		cv::VideoCapture capture(video);
+		if(!capture.isOpened())
+		{
+			std::cerr << "Can't open " << video << "\n";
+			return false;
+		}
+
+		cv::Mat frame;
+		while(int(frames->size()) < numFrames && capture.read(frame))
+		{
+			cv::Mat gray;
+			if(frame.channels() == 3)
+				cv::cvtColor(frame, gray, CV_BGR2GRAY);
+			else
+				gray = frame.clone();
+			frames->push_back(gray);
+		}
+
+		if(int(frames->size()) < numFrames)
+		{
+			std::cerr << video << " has only " << frames->size() << " frames\n";
+			return false;
+		}
+		return true;
+	}
+
+	std::vector<cv::Mat> resizedFrames(const std::vector<cv::Mat>& frames, cv::Size size)
+	{
+		std::vector<cv::Mat> resized(frames.size());
+		for(size_t i = 0; i < frames.size(); ++i)
+			cv::resize(frames[i], resized[i], size, 0, 0, cv::INTER_AREA);
+		return resized;
+	}
+
+	// Remembers masks of last frames for comparison between engines
+	class MaskHistory
+	{
+	public:
+		MaskHistory(int numFrames) : numFrames(numFrames) {}
+
+		void add(int frame, const cv::Mat& mask)
+		{
+			if(frame >= numFrames - agreementFrames)
+				masks.push_back(mask.clone());
+		}
+
+		double agreement(const MaskHistory& reference) const
+		{
+			if(masks.size() != reference.masks.size() || masks.empty())
+				return 0;
+
+			double equal = 0, total = 0;
+			for(size_t i = 0; i < masks.size(); ++i)
+			{
+				cv::Mat diff;
+				cv::compare(masks[i], reference.masks[i], diff, cv::CMP_EQ);
+				equal += cv::countNonZero(diff);
+				total += double(masks[i].total());
+			}
+			return equal / total;
+		}
+
+	private:
+		int numFrames;
+		std::vector<cv::Mat> masks;
+	};
+
+	double elapsedSeconds(int64_t start)
+	{
+		return (MonotonicClock::nanoseconds() - start) * 1e-9;
+	}
+
+	// Model is read and written once per pixel and mixture, plus frame and mask
+	double memoryTraffic(cv::Size size, int nmixtures)
+	{
+		return double(size.area()) * (2.0 * nmixtures * 3 * sizeof(float) + 2);
+	}
+
+	Result runNative(const std::vector<cv::Mat>& frames, const Options& opts,
+		int nmixtures, int numThreads, MaskHistory* masks)
+	{
+		const cv::Size size = frames[0].size();
+		MixtureOfGaussianCPU mog(size.height, size.width, history, 8, nmixtures);
+		mog.setMixtureParameters(varianceThreshold, backgroundRatio,
+			initialWeight, initialVariance, minVariance);
+		mog.setNumThreads(numThreads);
+
+		cv::Mat mask(size, CV_8UC1);
+		int64_t start = 0;
+		for(int i = 0; i < int(frames.size()); ++i)
+		{
+			if(i == opts.warmupFrames)
+				start = MonotonicClock::nanoseconds();
+			mog(frames[i], mask, learningRate);
+			masks->add(i, mask);
+		}
+
+		Result result;
+		result.engine = "native";
+		result.threads = numThreads;
+		result.seconds = elapsedSeconds(start);
+		result.deviceMs = 0;
+		result.modelBytes = memoryTraffic(size, nmixtures);
+		result.transferBytes = 0;
+		return result;
+	}
+
+	Result runOpenCV(const std::vector<cv::Mat>& frames, const Options& opts,
+		int nmixtures, MaskHistory* masks)
+	{
+		const cv::Size size = frames[0].size();
+		cv::BackgroundSubtractorMOG mog(history, nmixtures, backgroundRatio);
+
+		cv::Mat mask;
+		int64_t start = 0;
+		for(int i = 0; i < int(frames.size()); ++i)
+		{
+			if(i == opts.warmupFrames)
+				start = MonotonicClock::nanoseconds();
+			mog(frames[i], mask, learningRate);
+			masks->add(i, mask);
+		}
+
+		Result result;
+		result.engine = "opencv";
+		result.threads = 0;
+		result.seconds = elapsedSeconds(start);
+		result.deviceMs = 0;
+		// OpenCV keeps weight, mean and variance per mixture as well
+		result.modelBytes = memoryTraffic(size, nmixtures);
+		result.transferBytes = 0;
+		return result;
+	}
+
+	bool runOpenCL(const std::vector<cv::Mat>& frames, const Options& opts,
+		int nmixtures, MaskHistory* masks, Result* result)
+	{
+		clw::EDeviceType type = clw::Default;
+		if(opts.opencl == "cpu")
+			type = clw::Cpu;
+		else if(opts.opencl == "gpu")
+			type = clw::Gpu;
+
+		clw::Context context;
+		if(!context.create(type) || context.devices().empty())
+		{
+			std::cerr << "No OpenCL device of type " << opts.opencl << ", skipping\n";
+			return false;
+		}
+		clw::Device device = context.devices()[0];
+		clw::CommandQueue queue = context.createCommandQueue(clw::Property_ProfilingEnabled, device);
+
+		const cv::Size size = frames[0].size();
+		MixtureOfGaussianGPU mog(context, device, queue);
+		mog.setMixtureParameters(history, varianceThreshold, backgroundRatio,
+			initialWeight, initialVariance, minVariance);
+		mog.init(size.width, size.height, opts.workGroupSizeX, opts.workGroupSizeY, nmixtures);
+
+		clw::Image2D input = context.createImage2D(
+			clw::Access_ReadOnly, clw::Location_Device,
+			clw::ImageFormat(clw::Order_R, clw::Type_Normalized_UInt8),
+			size.width, size.height);
+
+		cv::Mat mask(size, CV_8UC1);
+		int64_t start = 0;
+		double kernelNs = 0;
+		for(int i = 0; i < int(frames.size()); ++i)
+		{
+			if(i == opts.warmupFrames)
+				start = MonotonicClock::nanoseconds();
+
+			queue.asyncWriteImage2D(input, frames[i].data, 0, 0, size.width, size.height);
+			clw::Event event = mog.process(input, learningRate);
+			queue.asyncReadImage2D(mog.output(), mask.data, 0, 0, size.width, size.height);
+			queue.finish();
+
+			if(i >= opts.warmupFrames)
+				kernelNs += double(event.finishTime() - event.startTime());
+			masks->add(i, mask);
+		}
+
+		result->engine = "opencl-" + opts.opencl;
+		result->threads = 0;
+		result->seconds = elapsedSeconds(start);
+		result->deviceMs = kernelNs * 1e-6 / (frames.size() - opts.warmupFrames);
+		result->modelBytes = memoryTraffic(size, nmixtures);
+		result->transferBytes = 2.0 * size.area();
+		std::cerr << "  OpenCL device: " << device.name() << "\n";
+		return true;
+	}
+
+	void printHeader(const Options& opts)
+	{
+		if(opts.json)
+			return;
+		std::cout << "engine,width,height,mixtures,threads,frames,seconds,mpix_per_s,ns_per_pixel,"
+			"model_bytes_per_frame,transfer_bytes_per_frame,model_gb_per_s,device_ms_per_frame,"
+			"mask_agreement\n";
+	}
+
+	void printResult(const Result& result, const Options& opts)
+	{
+		const double pixels = double(result.size.area()) * result.frames;
+		const double mpixPerSecond = pixels / result.seconds * 1e-6;
+		const double nsPerPixel = result.seconds * 1e9 / pixels;
+		const double gbPerSecond = result.modelBytes * result.frames / result.seconds * 1e-9;
+
+		if(opts.json)
+		{
+			std::cout << "{\"engine\":\"" << result.engine << "\""
+				<< ",\"width\":" << result.size.width
+				<< ",\"height\":" << result.size.height
+				<< ",\"mixtures\":" << result.mixtures
+				<< ",\"threads\":" << result.threads
+				<< ",\"frames\":" << result.frames
+				<< ",\"seconds\":" << result.seconds
+				<< ",\"mpix_per_s\":" << mpixPerSecond
+				<< ",\"ns_per_pixel\":" << nsPerPixel
+				<< ",\"model_bytes_per_frame\":" << result.modelBytes
+				<< ",\"transfer_bytes_per_frame\":" << result.transferBytes
+				<< ",\"model_gb_per_s\":" << gbPerSecond
+				<< ",\"device_ms_per_frame\":" << result.deviceMs
+				<< ",\"mask_agreement\":" << result.agreement << "}\n";
+		}
+		else
+		{
+			std::cout << result.engine << "," << result.size.width << "," << result.size.height
+				<< "," << result.mixtures << "," << result.threads << "," << result.frames
+				<< "," << result.seconds << "," << mpixPerSecond << "," << nsPerPixel
+				<< "," << result.modelBytes << "," << result.transferBytes << "," << gbPerSecond
+				<< "," << result.deviceMs << "," << result.agreement << "\n";
+		}
+		std::cout.flush();
+	}
+}
+
+int main(int argc, char** argv)
+{
+	Options opts;
+	if(!parseOptions(argc, argv, &opts))
+	{
+		std::cerr << "usage: mog-bench [--video file] [--frames N] [--warmup N]"
+			" [--sizes WxH,...] [--mixtures n,...] [--threads n,...]"
+			" [--opencl cpu|gpu|default|none] [--workgroup XxY] [--format csv|json]\n";
+		return -1;
+	}
+
+	std::vector<cv::Mat> recorded;
+	if(!opts.video.empty() && !recordedFrames(opts.video, opts.numFrames, &recorded))
+		return -1;
+
+	printHeader(opts);
+
+	for(auto& size : opts.sizes)
+	{
+		std::cerr << "Frames " << size.width << "x" << size.height << "\n";
+		std::vector<cv::Mat> frames = recorded.empty()
+			? syntheticFrames(size, opts.numFrames)
+			: resizedFrames(recorded, size);
+
+		for(int nmixtures : opts.mixtures)
+		{
+			if(nmixtures > maxNumMixtures)
+			{
+				std::cerr << "Skipping " << nmixtures << " mixtures (at most " << maxNumMixtures << ")\n";
+				continue;
+			}
+
+			std::vector<Result> results;
+			std::vector<MaskHistory> masks;
+
+			// Single threaded native engine is the reference for mask agreement
+			masks.push_back(MaskHistory(opts.numFrames));
+			results.push_back(runNative(frames, opts, nmixtures, 1, &masks.back()));
+
+			for(int numThreads : opts.threads)
+			{
+				if(numThreads == 1)
+					continue;
+				masks.push_back(MaskHistory(opts.numFrames));
+				results.push_back(runNative(frames, opts, nmixtures, numThreads, &masks.back()));
+			}
+
+			masks.push_back(MaskHistory(opts.numFrames));
+			results.push_back(runOpenCV(frames, opts, nmixtures, &masks.back()));
+
+			if(opts.opencl != "none")
+			{
+				Result result;
+				masks.push_back(MaskHistory(opts.numFrames));
+				if(runOpenCL(frames, opts, nmixtures, &masks.back(), &result))
+					results.push_back(result);
+				else
+					masks.pop_back();
+			}
+
+			for(size_t i = 0; i < results.size(); ++i)
+			{
+				results[i].size = size;
+				results[i].mixtures = nmixtures;
+				results[i].frames = opts.numFrames - opts.warmupFrames;
+				results[i].agreement = masks[i].agreement(masks[0]);
+				printResult(results[i], opts);
+			}
+		}
+	}
+}
@@ -22,6 +22,10 @@ newoption {
 	description = "Set path to a directory that contains opencv2 dynamic libraries"
 }
 
+newoption {
+	trigger     = "with-ffmpeg",
+	description = "Enable FFmpeg frame grabber (requires libavformat, libavcodec and libavutil)"
+}
 
 if os.get() == "linux" then 
 	_ACTION = _ACTION or "gmake"
@@ -36,13 +40,27 @@ end
 
 solution "mixture-of-gaussian"
 	configurations { "Debug", "Release" }
+	includedirs { "clw", _OPTIONS["openclincdir"], _OPTIONS["opencvincdir"] }
+	libdirs { _OPTIONS["opencllibdir"], _OPTIONS["opencvlibdir"] }
+	defines "CL_USE_DEPRECATED_OPENCL_1_1_APIS"	
+
+	configuration "Debug"
+		targetsuffix "_d"
+		defines { "DEBUG", "_DEBUG", }
+		flags { "Symbols", "ExtraWarnings" }
+	
+	configuration "Release"
+		defines "NDEBUG"	
+		flags { "OptimizeSpeed", "NoEditAndContinue", "NoFramePointer", "ExtraWarnings" }
+		
+	configuration { "linux", "gmake" }
+		buildoptions { "-std=c++11", "-fPIC", "-pthread" }
+		linkoptions { "-pthread" }
+
 	project "mixture-of-gaussian"
 		language "C++"
 	    location "proj"
 		kind "ConsoleApp"
-		includedirs { "clw", _OPTIONS["openclincdir"], _OPTIONS["opencvincdir"] }
-		libdirs { _OPTIONS["opencllibdir"], _OPTIONS["opencvlibdir"] }
-		defines "CL_USE_DEPRECATED_OPENCL_1_1_APIS"	
 		objdir "obj"
 		targetdir "."
 		
@@ -53,11 +71,27 @@ solution "mixture-of-gaussian"
 			"MixtureOfGaussianGPU.*",
 			"GrayscaleGPU.*",
 			"BayerFilterGPU.*",
+			"BayerFilterCPU.*",
+			"BayerPattern.h",
 			"FrameGrabber.*",
-			"QPCTimer.*",
 			"ConfigFile.*",
 			"WorkerCPU.*",
-			"WorkerGPU.*"
+			"WorkerGPU.*",
+			"SpscQueue.h",
+			"BitDepthConverter.*",
+			"StreamRegistry.h",
+			"LatestValue.h",
+			"ThreadedWorker.h",
+			"MaskSink.*",
+			"FrameGovernor.*",
+			"DeviceScheduler.*",
+			"WorkerHybrid.*",
+			"LatencyHistogram.*",
+			"StageProfiler.*",
+			"TraceRecorder.*",
+			"MonotonicClock.*",
+			"WorkGroupTuner.*",
+			"RegionOfInterest.*"
 		}
 			
 		links {
@@ -65,14 +99,30 @@ solution "mixture-of-gaussian"
 			"OpenCL"
 		}
 
-	configuration "Debug"
-		targetsuffix "_d"
-		defines { "DEBUG", "_DEBUG", }
-		flags { "Symbols", "ExtraWarnings" }
-	
-	configuration "Release"
-		defines "NDEBUG"	
-		flags { "OptimizeSpeed", "NoEditAndContinue", "NoFramePointer", "ExtraWarnings" }
-		
-	configuration { "linux", "gmake" }
-		buildoptions { "-std=c++11", "-fPIC" }
+		configuration "with-ffmpeg"
+			defines "FFMPEG_SUPPORT"
+			links { "avformat", "avcodec", "avutil" }
+
+	-- Throughput of MoG engines on synthetic or recorded frames
+	project "mog-bench"
+		language "C++"
+	    location "proj"
+		kind "ConsoleApp"
+		objdir "obj/mog-bench"
+		targetdir "."
+
+		files {
+			"clw/clw/*.cpp", "clw/clw/*.h",
+			"mog-bench.cpp",
+			"MixtureOfGaussianCPU.*",
+			"MixtureOfGaussianGPU.*",
+			"MonotonicClock.*",
+			"WorkGroupTuner.*",
+			"ConfigFile.*",
+			"RegionOfInterest.*"
+		}
+
+		links {
+			"opencv_core", "opencv_imgproc", "opencv_highgui", "opencv_video", 
+			"OpenCL"
+		}